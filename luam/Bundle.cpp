@@ -0,0 +1,457 @@
+// Bundle.cpp : Single-file application bundles, an indexed archive of compiled modules that is memory mapped at runtime.
+//
+
+#include "Bundle.h"
+
+#include "Chunk.h"
+#include "Dependencies.h"
+#include "FileUtils.h"
+#include "ModuleResolver.h"
+
+#include "Luau/Compiler.h"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Layout: header, module index sorted by resolved path, dependency index sorted by caller and name, name blob, then the
+// bytecode of every module aligned to 8 bytes. All offsets are from the start of the file.
+static const char kBundleMagic[8] = {'\x1b', 'L', 'u', 'a', 'M', 'B', 'N', 'D'};
+static const uint32_t kBundleVersion = 2;
+
+struct BundleHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t moduleCount;
+    uint32_t mainModule;
+    uint32_t dependencyCount;
+};
+
+struct BundleIndexEntry
+{
+    uint64_t nameOffset;
+    uint64_t nameSize;
+    uint64_t offset;
+    uint64_t size;
+};
+
+// require(name) from module caller loads module target
+struct BundleDependency
+{
+    uint32_t caller;
+    uint32_t target;
+    uint64_t nameOffset;
+    uint64_t nameSize;
+};
+
+struct MappedBundle
+{
+    std::string path;
+    const char* data = nullptr;
+    size_t size = 0;
+
+    const BundleIndexEntry* index() const
+    {
+        return reinterpret_cast<const BundleIndexEntry*>(data + sizeof(BundleHeader));
+    }
+
+    const BundleDependency* dependencies() const
+    {
+        return reinterpret_cast<const BundleDependency*>(index() + header().moduleCount);
+    }
+
+    const BundleHeader& header() const
+    {
+        return *reinterpret_cast<const BundleHeader*>(data);
+    }
+};
+
+struct BundleRegistry
+{
+    std::mutex mutex;
+    std::vector<std::unique_ptr<MappedBundle>> bundles;
+} gBundleRegistry;
+
+#ifdef _WIN32
+static std::wstring fromUtf8(const std::string& path)
+{
+    int length = MultiByteToWideChar(CP_UTF8, 0, path.data(), int(path.size()), nullptr, 0);
+
+    std::wstring result(length, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, path.data(), int(path.size()), &result[0], length);
+    return result;
+}
+#endif
+
+bool bundleWrite(const std::string& entry, const std::string& output, const Luau::CompileOptions& options, std::string& error)
+{
+    struct Module
+    {
+        std::string path;
+        std::string bytecode;
+
+        // require name and resolved path of every module this one requires
+        std::vector<std::pair<std::string, std::string>> dependencies;
+    };
+
+    std::vector<Module> modules;
+    std::unordered_set<std::string> seen = {entry};
+    std::deque<std::string> pending = {entry};
+
+    // breadth first over require calls with constant names, deduplicated by the file they resolve to
+    while (!pending.empty())
+    {
+        Module module = {pending.front()};
+        pending.pop_front();
+
+        std::optional<std::string> data = readFile(module.path);
+        if (!data)
+        {
+            error = "Error opening " + module.path;
+            return false;
+        }
+
+        if (!chunkFileToBytecode(module.path, *data, options, module.bytecode, error))
+        {
+            error = module.path + ": " + error;
+            return false;
+        }
+
+        if (module.bytecode.empty() || module.bytecode[0] == 0)
+        {
+            error = module.path + ": " + (module.bytecode.empty() ? std::string("empty chunk") : module.bytecode.substr(1));
+            return false;
+        }
+
+        // precompiled modules can't be scanned, their dependencies have to be required by source modules as well
+        std::vector<std::string> names;
+        if (getChunkKind(*data) == ChunkKind::Source)
+            findRequires(*data, names);
+
+        // modules are resolved like require does at runtime, relative to the module that requires them
+        std::string directory = getParentPath(module.path).value_or(std::string());
+
+        for (const std::string& name : names)
+        {
+            std::optional<std::string> path = moduleResolverResolve(name, directory);
+            if (!path)
+            {
+                error = module.path + ": Error opening " + name;
+                return false;
+            }
+
+            module.dependencies.emplace_back(name, *path);
+
+            if (seen.insert(*path).second)
+                pending.push_back(*path);
+        }
+
+        modules.push_back(std::move(module));
+    }
+
+    std::sort(modules.begin(), modules.end(), [](const Module& lhs, const Module& rhs) {
+        return lhs.path < rhs.path;
+    });
+
+    std::unordered_map<std::string, uint32_t> moduleIds;
+    for (size_t i = 0; i < modules.size(); ++i)
+        moduleIds[modules[i].path] = uint32_t(i);
+
+    BundleHeader header = {};
+    memcpy(header.magic, kBundleMagic, sizeof(header.magic));
+    header.version = kBundleVersion;
+    header.moduleCount = uint32_t(modules.size());
+    header.mainModule = moduleIds[entry];
+
+    // modules are sorted by path, so sorting each module's names keeps the whole table sorted by caller and name
+    std::vector<std::pair<uint32_t, std::pair<std::string, uint32_t>>> edges;
+
+    for (size_t i = 0; i < modules.size(); ++i)
+    {
+        std::vector<std::pair<std::string, std::string>> dependencies = modules[i].dependencies;
+        std::sort(dependencies.begin(), dependencies.end());
+
+        for (const auto& dependency : dependencies)
+            edges.push_back({uint32_t(i), {dependency.first, moduleIds[dependency.second]}});
+    }
+
+    header.dependencyCount = uint32_t(edges.size());
+
+    std::vector<BundleIndexEntry> index(modules.size());
+    std::vector<BundleDependency> dependencies(edges.size());
+    std::string names;
+
+    uint64_t namesOffset = sizeof(BundleHeader) + sizeof(BundleIndexEntry) * index.size() + sizeof(BundleDependency) * dependencies.size();
+
+    for (size_t i = 0; i < modules.size(); ++i)
+    {
+        index[i].nameOffset = namesOffset + names.size();
+        index[i].nameSize = modules[i].path.size();
+        names += modules[i].path;
+    }
+
+    for (size_t i = 0; i < edges.size(); ++i)
+    {
+        dependencies[i].caller = edges[i].first;
+        dependencies[i].target = edges[i].second.second;
+        dependencies[i].nameOffset = namesOffset + names.size();
+        dependencies[i].nameSize = edges[i].second.first.size();
+        names += edges[i].second.first;
+    }
+
+    uint64_t offset = (namesOffset + names.size() + 7) & ~uint64_t(7);
+
+    for (size_t i = 0; i < modules.size(); ++i)
+    {
+        index[i].offset = offset;
+        index[i].size = modules[i].bytecode.size();
+        offset = (offset + index[i].size + 7) & ~uint64_t(7);
+    }
+
+    std::string archive(reinterpret_cast<const char*>(&header), sizeof(header));
+    archive.append(reinterpret_cast<const char*>(index.data()), sizeof(BundleIndexEntry) * index.size());
+    archive.append(reinterpret_cast<const char*>(dependencies.data()), sizeof(BundleDependency) * dependencies.size());
+    archive += names;
+
+    for (size_t i = 0; i < modules.size(); ++i)
+    {
+        archive.resize(index[i].offset, '\0');
+        archive += modules[i].bytecode;
+    }
+
+    if (!writeFile(output, archive))
+    {
+        error = "Error writing " + output;
+        return false;
+    }
+
+    return true;
+}
+
+bool bundleIsArchive(const std::string& path)
+{
+#ifdef _WIN32
+    FILE* file = _wfopen(fromUtf8(path).c_str(), L"rb");
+#else
+    FILE* file = fopen(path.c_str(), "rb");
+#endif
+
+    if (!file)
+        return false;
+
+    char magic[sizeof(kBundleMagic)] = {};
+    size_t read = fread(magic, 1, sizeof(magic), file);
+    fclose(file);
+
+    return read == sizeof(magic) && memcmp(magic, kBundleMagic, sizeof(magic)) == 0;
+}
+
+static bool mapFile(const std::string& path, MappedBundle& bundle)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileW(fromUtf8(path).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size = {};
+    GetFileSizeEx(file, &size);
+
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+
+    if (!mapping)
+        return false;
+
+    void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+
+    if (!data)
+        return false;
+
+    bundle.data = static_cast<const char*>(data);
+    bundle.size = size_t(size.QuadPart);
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st = {};
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED)
+        return false;
+
+    bundle.data = static_cast<const char*>(data);
+    bundle.size = size_t(st.st_size);
+#endif
+
+    return true;
+}
+
+static bool validateBundle(const MappedBundle& bundle, std::string& error)
+{
+    if (bundle.size < sizeof(BundleHeader) || memcmp(bundle.header().magic, kBundleMagic, sizeof(kBundleMagic)) != 0)
+    {
+        error = "not a luam bundle";
+        return false;
+    }
+
+    const BundleHeader& header = bundle.header();
+
+    if (header.version != kBundleVersion)
+    {
+        error = "bundle version " + std::to_string(header.version) + " is not supported (this build reads version " +
+                std::to_string(kBundleVersion) + ")";
+        return false;
+    }
+
+    size_t available = bundle.size - sizeof(BundleHeader);
+
+    if (header.moduleCount == 0 || header.mainModule >= header.moduleCount || available / sizeof(BundleIndexEntry) < header.moduleCount ||
+        (available - sizeof(BundleIndexEntry) * header.moduleCount) / sizeof(BundleDependency) < header.dependencyCount)
+    {
+        error = "corrupt bundle index";
+        return false;
+    }
+
+    for (uint32_t i = 0; i < header.moduleCount; ++i)
+    {
+        const BundleIndexEntry& entry = bundle.index()[i];
+
+        if (entry.nameOffset > bundle.size || entry.nameSize > bundle.size - entry.nameOffset || entry.offset > bundle.size ||
+            entry.size > bundle.size - entry.offset)
+        {
+            error = "corrupt bundle index";
+            return false;
+        }
+    }
+
+    for (uint32_t i = 0; i < header.dependencyCount; ++i)
+    {
+        const BundleDependency& dependency = bundle.dependencies()[i];
+
+        if (dependency.caller >= header.moduleCount || dependency.target >= header.moduleCount || dependency.nameOffset > bundle.size ||
+            dependency.nameSize > bundle.size - dependency.nameOffset)
+        {
+            error = "corrupt bundle index";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static BundleModule getModule(const MappedBundle& bundle, uint32_t id)
+{
+    const BundleIndexEntry& entry = bundle.index()[id];
+
+    return {std::string(bundle.data + entry.nameOffset, size_t(entry.nameSize)), bundle.data + entry.offset, size_t(entry.size)};
+}
+
+std::optional<BundleModule> bundleMount(const std::string& path, std::string& error)
+{
+    std::unique_ptr<MappedBundle> bundle(new MappedBundle());
+    bundle->path = path;
+
+    if (!mapFile(path, *bundle))
+    {
+        error = "Error opening " + path;
+        return std::nullopt;
+    }
+
+    // an invalid bundle stays mapped; it's an error the process is about to report and exit on
+    if (!validateBundle(*bundle, error))
+    {
+        error = path + ": " + error;
+        return std::nullopt;
+    }
+
+    BundleModule result = getModule(*bundle, bundle->header().mainModule);
+
+    std::unique_lock<std::mutex> lock(gBundleRegistry.mutex);
+    gBundleRegistry.bundles.push_back(std::move(bundle));
+
+    return result;
+}
+
+// the main chunk runs under the bundle's own path, every other module under the path it was bundled from
+static std::optional<uint32_t> findCaller(const MappedBundle& bundle, const std::string& caller)
+{
+    if (caller == bundle.path)
+        return bundle.header().mainModule;
+
+    const BundleIndexEntry* begin = bundle.index();
+    const BundleIndexEntry* end = begin + bundle.header().moduleCount;
+
+    const char* data = bundle.data;
+
+    const BundleIndexEntry* it = std::lower_bound(begin, end, caller, [data](const BundleIndexEntry& entry, const std::string& key) {
+        return key.compare(0, std::string::npos, data + entry.nameOffset, size_t(entry.nameSize)) > 0;
+    });
+
+    if (it != end && caller.compare(0, std::string::npos, data + it->nameOffset, size_t(it->nameSize)) == 0)
+        return uint32_t(it - begin);
+
+    return std::nullopt;
+}
+
+std::optional<BundleModule> bundleFindModule(const std::string& caller, const std::string& name)
+{
+    std::unique_lock<std::mutex> lock(gBundleRegistry.mutex);
+
+    for (const std::unique_ptr<MappedBundle>& bundle : gBundleRegistry.bundles)
+    {
+        std::optional<uint32_t> id = findCaller(*bundle, caller);
+        if (!id)
+            continue;
+
+        const BundleDependency* begin = bundle->dependencies();
+        const BundleDependency* end = begin + bundle->header().dependencyCount;
+
+        const char* data = bundle->data;
+        uint32_t callerId = *id;
+
+        const BundleDependency* it = std::lower_bound(begin, end, name, [data, callerId](const BundleDependency& entry, const std::string& key) {
+            if (entry.caller != callerId)
+                return entry.caller < callerId;
+
+            return key.compare(0, std::string::npos, data + entry.nameOffset, size_t(entry.nameSize)) > 0;
+        });
+
+        if (it != end && it->caller == callerId && name.compare(0, std::string::npos, data + it->nameOffset, size_t(it->nameSize)) == 0)
+            return getModule(*bundle, it->target);
+    }
+
+    return std::nullopt;
+}
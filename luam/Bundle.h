@@ -0,0 +1,36 @@
+// Bundle.h : Single-file application bundles, an indexed archive of compiled modules that is memory mapped at runtime.
+//
+
+#pragma once
+
+#include <optional>
+#include <string>
+
+#include <stddef.h>
+
+namespace Luau
+{
+struct CompileOptions;
+}
+
+struct BundleModule
+{
+    std::string path;
+    const char* bytecode;
+    size_t size;
+};
+
+// Compiles entry and every module it requires, transitively, into one archive at output. Modules are indexed by the path
+// require resolves them to, along with the name each module used to require each of its dependencies, so the same name
+// required from two directories stays two modules; the entry becomes the bundle's main chunk.
+bool bundleWrite(const std::string& entry, const std::string& output, const Luau::CompileOptions& options, std::string& error);
+
+bool bundleIsArchive(const std::string& path);
+
+// Maps the bundle at path and serves its modules through bundleFindModule from then on; returns its main chunk.
+// Bundles stay mapped for the lifetime of the process, so the returned bytecode never has to be copied.
+std::optional<BundleModule> bundleMount(const std::string& path, std::string& error);
+
+// Finds the module that require(name) loads when called from the chunk named caller (without its '=' prefix), as it was
+// resolved when the bundle was written; nullopt when caller isn't part of a mounted bundle or never required name.
+std::optional<BundleModule> bundleFindModule(const std::string& caller, const std::string& name);
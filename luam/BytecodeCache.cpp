@@ -0,0 +1,192 @@
+// BytecodeCache.cpp : Persistent on-disk cache of compiled chunks.
+//
+
+#include "BytecodeCache.h"
+
+#include "FileUtils.h"
+
+#include "Luau/Bytecode.h"
+#include "Luau/Compiler.h"
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// part of every key; bump it whenever the compiler is updated in a way that keeps LBC_VERSION_TARGET the same
+static const char* const kCompilerVersion = "luam-bc-1";
+
+static const char kMagic[] = "LUAMBCC2";
+
+// a cache file is the header, a copy of the source and then the bytecode; the file is named after the hashes, and the
+// source is compared on load, so two sources that hash the same are a miss rather than the wrong chunk
+struct BytecodeCacheHeader
+{
+    char magic[8];
+    uint64_t sourceHash;
+    uint64_t sourceSize;
+    uint64_t optionsHash;
+};
+
+static std::string gBytecodeCacheDirectory;
+
+void bytecodeCacheSetDirectory(const std::string& path)
+{
+    gBytecodeCacheDirectory = path;
+}
+
+// FNV-1a
+static uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+
+    for (size_t i = 0; i < size; ++i)
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+
+    return hash;
+}
+
+static uint64_t hashOptions(const Luau::CompileOptions& options)
+{
+    int values[] = {options.optimizationLevel, options.debugLevel, options.coverageLevel, LBC_VERSION_TARGET};
+
+    uint64_t hash = hashBytes(values, sizeof(values));
+    return hashBytes(kCompilerVersion, strlen(kCompilerVersion), hash);
+}
+
+std::string bytecodeCacheCompile(const std::string& source, const Luau::CompileOptions& options)
+{
+    if (gBytecodeCacheDirectory.empty())
+        return Luau::compile(source, options);
+
+    BytecodeCacheHeader header = {};
+    memcpy(header.magic, kMagic, sizeof(header.magic));
+    header.sourceHash = hashBytes(source.data(), source.size());
+    header.sourceSize = source.size();
+    header.optionsHash = hashOptions(options);
+
+    char name[64];
+    snprintf(name, sizeof(name), "%016llx%016llx.luac", (unsigned long long)header.sourceHash,
+        (unsigned long long)header.optionsHash);
+
+    std::string path = joinPaths(gBytecodeCacheDirectory, name);
+
+    if (std::optional<std::string> cached = readFile(path))
+    {
+        if (cached->size() > sizeof(header) + source.size() && memcmp(cached->data(), &header, sizeof(header)) == 0 &&
+            cached->compare(sizeof(header), source.size(), source) == 0)
+            return cached->substr(sizeof(header) + source.size());
+    }
+
+    std::string bytecode = Luau::compile(source, options);
+
+    // a leading zero byte marks a compile error
+    if (!bytecode.empty() && bytecode[0] != 0 && createDirectory(gBytecodeCacheDirectory))
+    {
+        std::string data(reinterpret_cast<const char*>(&header), sizeof(header));
+        data += source;
+        data += bytecode;
+
+        // failing to write the cache only costs the next run a compile
+        writeFile(path, data);
+    }
+
+    return bytecode;
+}
+
+struct BytecodeMemoryCacheEntry
+{
+    uint64_t key;
+    std::string source; // compared on lookup, so colliding keys are a miss rather than the wrong chunk
+    std::string bytecode;
+};
+
+struct BytecodeMemoryCache
+{
+    std::mutex mutex;
+
+    // most recently used first
+    std::list<BytecodeMemoryCacheEntry> entries;
+    std::unordered_map<uint64_t, std::list<BytecodeMemoryCacheEntry>::iterator> index;
+
+    size_t capacity = 256;
+    BytecodeMemoryCacheStats stats;
+} gBytecodeMemoryCache;
+
+static void evictLocked(BytecodeMemoryCache& cache, size_t capacity)
+{
+    while (cache.entries.size() > capacity)
+    {
+        cache.index.erase(cache.entries.back().key);
+        cache.entries.pop_back();
+        cache.stats.evictions++;
+    }
+}
+
+void bytecodeMemoryCacheSetCapacity(size_t entries)
+{
+    std::unique_lock<std::mutex> lock(gBytecodeMemoryCache.mutex);
+
+    gBytecodeMemoryCache.capacity = entries;
+    evictLocked(gBytecodeMemoryCache, entries);
+}
+
+std::string bytecodeMemoryCacheCompile(const std::string& source, const Luau::CompileOptions& options)
+{
+    BytecodeMemoryCache& cache = gBytecodeMemoryCache;
+    uint64_t key = hashBytes(source.data(), source.size(), hashOptions(options));
+
+    {
+        std::unique_lock<std::mutex> lock(cache.mutex);
+
+        if (cache.capacity == 0)
+        {
+            lock.unlock();
+            return bytecodeCacheCompile(source, options);
+        }
+
+        auto it = cache.index.find(key);
+
+        if (it != cache.index.end() && it->second->source == source)
+        {
+            cache.entries.splice(cache.entries.begin(), cache.entries, it->second);
+            cache.stats.hits++;
+            return it->second->bytecode;
+        }
+
+        cache.stats.misses++;
+    }
+
+    // compile outside of the lock, other VMs may be loading at the same time
+    std::string bytecode = bytecodeCacheCompile(source, options);
+
+    std::unique_lock<std::mutex> lock(cache.mutex);
+
+    auto it = cache.index.find(key);
+
+    if (it != cache.index.end())
+    {
+        cache.entries.erase(it->second);
+        cache.index.erase(it);
+    }
+
+    cache.entries.push_front({key, source, bytecode});
+    cache.index[key] = cache.entries.begin();
+
+    evictLocked(cache, cache.capacity);
+
+    return bytecode;
+}
+
+BytecodeMemoryCacheStats bytecodeMemoryCacheGetStats()
+{
+    std::unique_lock<std::mutex> lock(gBytecodeMemoryCache.mutex);
+
+    BytecodeMemoryCacheStats stats = gBytecodeMemoryCache.stats;
+    stats.entries = gBytecodeMemoryCache.entries.size();
+    stats.capacity = gBytecodeMemoryCache.capacity;
+    return stats;
+}
@@ -0,0 +1,36 @@
+// BytecodeCache.h : Persistent on-disk cache of compiled chunks.
+//
+
+#pragma once
+
+#include <string>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Luau
+{
+struct CompileOptions;
+}
+
+// Enables the cache in the given directory (created on first write); an empty path disables it.
+void bytecodeCacheSetDirectory(const std::string& path);
+
+// Compiles source, reusing bytecode a previous run stored for the same source, options and compiler version.
+// Chunks that fail to compile are never cached, so the error is reported the same way as without the cache.
+std::string bytecodeCacheCompile(const std::string& source, const Luau::CompileOptions& options);
+
+struct BytecodeMemoryCacheStats
+{
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t entries = 0;
+    size_t capacity = 0;
+};
+
+// In-memory LRU cache in front of bytecodeCacheCompile, shared by every VM in the process; used by loadstring, which
+// scripts tend to call over and over with the same generated source. A capacity of 0 entries disables it.
+void bytecodeMemoryCacheSetCapacity(size_t entries);
+std::string bytecodeMemoryCacheCompile(const std::string& source, const Luau::CompileOptions& options);
+BytecodeMemoryCacheStats bytecodeMemoryCacheGetStats();
@@ -0,0 +1,131 @@
+// Chunk.cpp : Turns source files, raw Luau bytecode and luam bytecode containers into loadable bytecode.
+//
+
+#include "Chunk.h"
+
+#include "BytecodeCache.h"
+#include "FileUtils.h"
+
+#include "Luau/Bytecode.h"
+#include "Luau/Compiler.h"
+
+#include <optional>
+
+#include <string.h>
+
+// the escape character can't start a source file, same trick as Lua's "\x1bLua"
+static const char kContainerMagic[] = "\x1bLuaM";
+static const size_t kContainerMagicSize = sizeof(kContainerMagic) - 1;
+
+static const unsigned char kContainerVersion = 1;
+
+// magic, container version, bytecode version, reserved
+static const size_t kContainerHeaderSize = kContainerMagicSize + 3;
+
+ChunkKind getChunkKind(const std::string& data)
+{
+    if (data.size() >= kContainerMagicSize && memcmp(data.data(), kContainerMagic, kContainerMagicSize) == 0)
+        return ChunkKind::Container;
+
+    // bytecode starts with its version (or a zero byte for a compile error), source starts with printable text
+    if (!data.empty())
+    {
+        unsigned char first = data[0];
+
+        if (first < 32 && first != '\t' && first != '\n' && first != '\r')
+            return ChunkKind::Bytecode;
+    }
+
+    return ChunkKind::Source;
+}
+
+std::string makeBytecodeContainer(const std::string& bytecode)
+{
+    std::string result(kContainerMagic, kContainerMagicSize);
+    result += char(kContainerVersion);
+    result += bytecode.empty() ? char(0) : bytecode[0];
+    result += char(0);
+    result += bytecode;
+    return result;
+}
+
+static bool checkBytecodeVersion(unsigned char version, std::string& error)
+{
+    // version 0 carries a compile error, luau_load reports it
+    if (version == 0 || (version >= LBC_VERSION_MIN && version <= LBC_VERSION_MAX))
+        return true;
+
+    error = "bytecode version " + std::to_string(version) + " is not supported (this build loads versions " +
+            std::to_string(LBC_VERSION_MIN) + " to " + std::to_string(LBC_VERSION_MAX) + ")";
+    return false;
+}
+
+bool chunkToBytecode(const std::string& data, const Luau::CompileOptions& options, std::string& bytecode, std::string& error)
+{
+    switch (getChunkKind(data))
+    {
+    case ChunkKind::Source:
+        bytecode = bytecodeCacheCompile(data, options);
+        return true;
+
+    case ChunkKind::Bytecode:
+        if (!checkBytecodeVersion(data[0], error))
+            return false;
+
+        bytecode = data;
+        return true;
+
+    case ChunkKind::Container:
+    {
+        if (data.size() <= kContainerHeaderSize)
+        {
+            error = "truncated luam bytecode container";
+            return false;
+        }
+
+        unsigned char version = data[kContainerMagicSize];
+
+        if (version > kContainerVersion)
+        {
+            error = "luam bytecode container version " + std::to_string(version) + " is not supported (this build reads up to " +
+                    std::to_string(kContainerVersion) + ")";
+            return false;
+        }
+
+        if (!checkBytecodeVersion(data[kContainerMagicSize + 1], error))
+            return false;
+
+        bytecode = data.substr(kContainerHeaderSize);
+        return true;
+    }
+    }
+
+    return false;
+}
+
+bool chunkFileToBytecode(
+    const std::string& path, const std::string& data, const Luau::CompileOptions& options, std::string& bytecode, std::string& error)
+{
+    if (chunkToBytecode(data, options, bytecode, error))
+        return true;
+
+    size_t dot = path.find_last_of(".\\/");
+    std::string stem = dot != std::string::npos && path[dot] == '.' ? path.substr(0, dot) : path;
+
+    for (const char* extension : {".luam", ".lua", ".luau"})
+    {
+        if (stem + extension == path)
+            continue;
+
+        std::optional<std::string> source = readFile(stem + extension);
+
+        if (source && getChunkKind(*source) == ChunkKind::Source)
+        {
+            bytecode = bytecodeCacheCompile(*source, options);
+            return true;
+        }
+    }
+
+    error += "; no source file to fall back to";
+    return false;
+}
@@ -0,0 +1,36 @@
+// Chunk.h : Turns source files, raw Luau bytecode and luam bytecode containers into loadable bytecode.
+//
+
+#pragma once
+
+#include <string>
+
+namespace Luau
+{
+struct CompileOptions;
+}
+
+// Extensions require tries after the module name, precompiled bytecode first.
+static const char* const kRequireExtensions[] = {".luac", ".luam", ".lua"};
+
+enum class ChunkKind
+{
+    Source,
+    Bytecode,  // raw Luau bytecode, as written by --compile=binary
+    Container, // luam container, as written by --compile=luam
+};
+
+ChunkKind getChunkKind(const std::string& data);
+
+// Wraps bytecode into a luam container, which records the container and bytecode versions in a small header.
+std::string makeBytecodeContainer(const std::string& bytecode);
+
+// Produces bytecode for luau_load from the contents of a file: source is compiled (through the bytecode cache),
+// bytecode is passed through once its version has been checked against what this VM can load. Returns false and sets
+// error when it can't be loaded.
+bool chunkToBytecode(const std::string& data, const Luau::CompileOptions& options, std::string& bytecode, std::string& error);
+
+// Like chunkToBytecode for the file at path; when precompiled bytecode can't be loaded, a source file next to it with
+// the same name (.luam, .lua or .luau) is compiled instead.
+bool chunkFileToBytecode(
+    const std::string& path, const std::string& data, const Luau::CompileOptions& options, std::string& bytecode, std::string& error);
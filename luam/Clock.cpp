@@ -0,0 +1,28 @@
+// Clock.cpp : Monotonic high resolution clock used for scheduler deadlines and script timing.
+//
+
+#include "Clock.h"
+
+#include <chrono>
+
+uint64_t clockNanoseconds()
+{
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+struct ClockAnchor
+{
+    uint64_t steady = clockNanoseconds();
+    double epoch = std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+} gClockAnchor;
+
+double clockElapsedSeconds()
+{
+    return clockToSeconds(clockNanoseconds() - gClockAnchor.steady);
+}
+
+double clockEpochSeconds()
+{
+    return gClockAnchor.epoch + clockElapsedSeconds();
+}
@@ -0,0 +1,35 @@
+// Clock.h : Monotonic high resolution clock used for scheduler deadlines and script timing.
+//
+
+#pragma once
+
+#include <chrono>
+
+#include <stdint.h>
+
+// Nanoseconds on the steady clock; unaffected by wall clock adjustments.
+uint64_t clockNanoseconds();
+
+// Seconds since the process started.
+double clockElapsedSeconds();
+
+// Wall clock seconds since the Unix epoch. The wall clock is sampled once and then advanced with the steady clock,
+// so the value never jumps when the system time is adjusted.
+double clockEpochSeconds();
+
+inline double clockToSeconds(uint64_t nanoseconds)
+{
+    return double(nanoseconds) * 1e-9;
+}
+
+inline uint64_t clockFromSeconds(double seconds)
+{
+    return seconds > 0 ? uint64_t(seconds * 1e9) : 0;
+}
+
+// clockNanoseconds() value as a steady_clock time point, for deadlines passed to sleep_until and wait_until
+inline std::chrono::steady_clock::time_point clockToTimePoint(uint64_t nanoseconds)
+{
+    using namespace std::chrono;
+    return steady_clock::time_point(duration_cast<steady_clock::duration>(std::chrono::nanoseconds(nanoseconds)));
+}
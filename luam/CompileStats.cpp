@@ -0,0 +1,141 @@
+// CompileStats.cpp : Size and per-phase timing statistics of --compile runs.
+//
+
+#include "CompileStats.h"
+
+#include "TextFormat.h"
+
+#include <algorithm>
+#include <iterator>
+
+CompileStats& CompileStats::operator+=(const CompileStats& other)
+{
+    lines += other.lines;
+    bytecode += other.bytecode;
+    codegen += other.codegen;
+
+    files.insert(files.end(), other.files.begin(), other.files.end());
+    return *this;
+}
+
+struct CompilePhase
+{
+    const char* name;
+    double CompileFileStats::*time;
+};
+
+static const CompilePhase kCompilePhases[] = {
+    {"read", &CompileFileStats::readTime},
+    {"parse", &CompileFileStats::parseTime},
+    {"compile", &CompileFileStats::compileTime},
+    {"codegen", &CompileFileStats::codegenTime},
+};
+
+static double megabytesPerSecond(size_t bytes, double seconds)
+{
+    return seconds > 0 ? double(bytes) / (1024.0 * 1024.0) / seconds : 0.0;
+}
+
+static std::string textReport(const CompileStats& stats, const double* phaseTimes, size_t sourceBytes, const std::vector<const CompileFileStats*>& slowest)
+{
+    std::string result;
+
+    appendFormat(result, "Compiled %d files, %d lines, %.1f KB of source in %.3f s\n", int(stats.files.size()), int(stats.lines),
+        double(sourceBytes) / 1024.0, stats.wallTime);
+
+    double total = 0;
+
+    for (size_t i = 0; i < std::size(kCompilePhases); ++i)
+    {
+        appendFormat(result, "  %-8s %10.3f ms %10.2f MB/s\n", kCompilePhases[i].name, phaseTimes[i] * 1e3,
+            megabytesPerSecond(sourceBytes, phaseTimes[i]));
+        total += phaseTimes[i];
+    }
+
+    appendFormat(result, "  %-8s %10.3f ms %10.2f MB/s\n", "total", total * 1e3, megabytesPerSecond(sourceBytes, total));
+
+    if (!slowest.empty())
+    {
+        appendFormat(result, "Slowest files:\n");
+
+        for (const CompileFileStats* file : slowest)
+        {
+            appendFormat(result, "  %10.3f ms %8d lines  (read %.3f, parse %.3f, compile %.3f, codegen %.3f)  ", file->totalTime() * 1e3,
+                int(file->lines), file->readTime * 1e3, file->parseTime * 1e3, file->compileTime * 1e3, file->codegenTime * 1e3);
+            result += file->name;
+            result += '\n';
+        }
+    }
+
+    return result;
+}
+
+static std::string jsonReport(const CompileStats& stats, const double* phaseTimes, size_t sourceBytes, const std::vector<const CompileFileStats*>& slowest)
+{
+    std::string result;
+
+    appendFormat(result, "{\n  \"files\": %d,\n  \"lines\": %d,\n  \"sourceBytes\": %d,\n  \"bytecodeBytes\": %d,\n  \"codegenBytes\": %d,\n",
+        int(stats.files.size()), int(stats.lines), int(sourceBytes), int(stats.bytecode), int(stats.codegen));
+    appendFormat(result, "  \"wallTime\": %.6f,\n  \"phases\": {\n", stats.wallTime);
+
+    for (size_t i = 0; i < std::size(kCompilePhases); ++i)
+        appendFormat(result, "    \"%s\": {\"time\": %.6f, \"mbps\": %.3f}%s\n", kCompilePhases[i].name, phaseTimes[i],
+            megabytesPerSecond(sourceBytes, phaseTimes[i]), i + 1 < std::size(kCompilePhases) ? "," : "");
+
+    result += "  },\n  \"slowest\": [";
+
+    for (size_t i = 0; i < slowest.size(); ++i)
+    {
+        const CompileFileStats* file = slowest[i];
+
+        result += i == 0 ? "\n    {\"name\": " : ",\n    {\"name\": ";
+        appendJsonString(result, file->name);
+        appendFormat(result, ", \"sourceBytes\": %d, \"lines\": %d, \"total\": %.6f", int(file->sourceBytes), int(file->lines), file->totalTime());
+
+        for (const CompilePhase& phase : kCompilePhases)
+            appendFormat(result, ", \"%s\": %.6f", phase.name, file->*phase.time);
+
+        result += "}";
+    }
+
+    result += slowest.empty() ? "]\n}\n" : "\n  ]\n}\n";
+    return result;
+}
+
+std::string compileStatsReport(const CompileStats& stats, CompileReportFormat format, size_t slowest)
+{
+    double phaseTimes[std::size(kCompilePhases)] = {};
+    size_t sourceBytes = 0;
+
+    for (const CompileFileStats& file : stats.files)
+    {
+        for (size_t i = 0; i < std::size(kCompilePhases); ++i)
+            phaseTimes[i] += file.*kCompilePhases[i].time;
+
+        sourceBytes += file.sourceBytes;
+    }
+
+    std::vector<const CompileFileStats*> files;
+    files.reserve(stats.files.size());
+
+    for (const CompileFileStats& file : stats.files)
+        files.push_back(&file);
+
+    slowest = std::min(slowest, files.size());
+    std::partial_sort(files.begin(), files.begin() + slowest, files.end(), [](const CompileFileStats* a, const CompileFileStats* b) {
+        return a->totalTime() > b->totalTime();
+    });
+    files.resize(slowest);
+
+    switch (format)
+    {
+    case CompileReportFormat::Text:
+        return textReport(stats, phaseTimes, sourceBytes, files);
+    case CompileReportFormat::Json:
+        return jsonReport(stats, phaseTimes, sourceBytes, files);
+    case CompileReportFormat::None:
+        break;
+    }
+
+    return std::string();
+}
@@ -0,0 +1,51 @@
+// CompileStats.h : Size and per-phase timing statistics of --compile runs.
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <stddef.h>
+
+// wall time of every phase a file went through, in seconds; phases it didn't reach (or that the format skips) stay 0
+struct CompileFileStats
+{
+    std::string name;
+    size_t sourceBytes = 0;
+    size_t lines = 0;
+
+    double readTime = 0;
+    double parseTime = 0;
+    double compileTime = 0;
+    double codegenTime = 0;
+
+    double totalTime() const
+    {
+        return readTime + parseTime + compileTime + codegenTime;
+    }
+};
+
+struct CompileStats
+{
+    size_t lines = 0;
+    size_t bytecode = 0;
+    size_t codegen = 0;
+
+    std::vector<CompileFileStats> files;
+
+    // wall time of the whole run; with --jobs the phase times of all files add up to more than this
+    double wallTime = 0;
+
+    CompileStats& operator+=(const CompileStats& other);
+};
+
+enum class CompileReportFormat
+{
+    None,
+    Text,
+    Json,
+};
+
+// Per-phase totals and throughput in MB/s over every file, followed by the slowest files by total time.
+std::string compileStatsReport(const CompileStats& stats, CompileReportFormat format, size_t slowest);
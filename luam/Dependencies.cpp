@@ -0,0 +1,51 @@
+// Dependencies.cpp : Static discovery of the modules a chunk requires.
+//
+
+#include "Dependencies.h"
+
+#include "Luau/Ast.h"
+#include "Luau/Parser.h"
+
+#include <algorithm>
+
+struct RequireVisitor : Luau::AstVisitor
+{
+    std::vector<std::string>& names;
+
+    explicit RequireVisitor(std::vector<std::string>& names)
+        : names(names)
+    {
+    }
+
+    bool visit(Luau::AstExprCall* node) override
+    {
+        Luau::AstExprGlobal* global = node->func->as<Luau::AstExprGlobal>();
+
+        if (global && global->name == "require" && node->args.size == 1)
+        {
+            if (Luau::AstExprConstantString* name = node->args.data[0]->as<Luau::AstExprConstantString>())
+            {
+                std::string value(name->value.data, name->value.size);
+
+                if (std::find(names.begin(), names.end(), value) == names.end())
+                    names.push_back(value);
+            }
+        }
+
+        return true;
+    }
+};
+
+bool findRequires(const std::string& source, std::vector<std::string>& names)
+{
+    Luau::Allocator allocator;
+    Luau::AstNameTable nameTable(allocator);
+    Luau::ParseResult result = Luau::Parser::parse(source.data(), source.size(), nameTable, allocator);
+
+    if (!result.errors.empty())
+        return false;
+
+    RequireVisitor visitor(names);
+    result.root->visit(&visitor);
+    return true;
+}
@@ -0,0 +1,12 @@
+// Dependencies.h : Static discovery of the modules a chunk requires.
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Collects the names passed to require("...") with a constant string anywhere in source, in order of appearance and
+// without duplicates; calls with computed names can't be resolved statically and are skipped. Returns false when the
+// source doesn't parse.
+bool findRequires(const std::string& source, std::vector<std::string>& names);
@@ -13,6 +13,7 @@
 #include <Windows.h>
 #else
 #include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
@@ -20,6 +21,8 @@
 
 #include <string.h>
 
+#include <atomic>
+
 #ifdef _WIN32
 static std::wstring fromUtf8(const std::string& path)
 {
@@ -94,6 +97,59 @@ std::optional<std::string> readStdin()
     return result;
 }
 
+bool writeFile(const std::string& name, const std::string& data)
+{
+    static std::atomic<unsigned> counter{0};
+
+#ifdef _WIN32
+    unsigned process = unsigned(GetCurrentProcessId());
+#else
+    unsigned process = unsigned(getpid());
+#endif
+
+    std::string temp = name + ".tmp" + std::to_string(process) + "." + std::to_string(counter++);
+
+#ifdef _WIN32
+    FILE* file = _wfopen(fromUtf8(temp).c_str(), L"wb");
+#else
+    FILE* file = fopen(temp.c_str(), "wb");
+#endif
+
+    if (!file)
+        return false;
+
+    bool written = fwrite(data.data(), 1, data.size(), file) == data.size();
+    written = fclose(file) == 0 && written;
+
+#ifdef _WIN32
+    written = written && MoveFileExW(fromUtf8(temp).c_str(), fromUtf8(name).c_str(), MOVEFILE_REPLACE_EXISTING);
+    if (!written)
+        DeleteFileW(fromUtf8(temp).c_str());
+#else
+    written = written && rename(temp.c_str(), name.c_str()) == 0;
+    if (!written)
+        unlink(temp.c_str());
+#endif
+
+    return written;
+}
+
+bool createDirectory(const std::string& path)
+{
+    if (path.empty() || isDirectory(path))
+        return true;
+
+    if (std::optional<std::string> parent = getParentPath(path))
+        if (!createDirectory(*parent))
+            return false;
+
+#ifdef _WIN32
+    return CreateDirectoryW(fromUtf8(path).c_str(), nullptr) || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+    return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+#endif
+}
+
 template<typename Ch>
 static void joinPaths(std::basic_string<Ch>& str, const Ch* lhs, const Ch* rhs)
 {
@@ -221,6 +277,21 @@ bool isDirectory(const std::string& path)
 #endif
 }
 
+bool isFile(const std::string& path)
+{
+#ifdef _WIN32
+    DWORD fileAttributes = GetFileAttributesW(fromUtf8(path).c_str());
+    if (fileAttributes == INVALID_FILE_ATTRIBUTES)
+        return false;
+    return (fileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0;
+#else
+    struct stat st = {};
+    if (stat(path.c_str(), &st) != 0)
+        return false;
+    return (st.st_mode & S_IFMT) == S_IFREG;
+#endif
+}
+
 std::string joinPaths(const std::string& lhs, const std::string& rhs)
 {
     std::string result = lhs;
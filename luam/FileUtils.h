@@ -8,8 +8,13 @@
 
 std::optional<std::string> readFile(const std::string& name);
 std::optional<std::string> readStdin();
+// Writes the whole file through a temporary that is renamed into place, so concurrent readers never see partial data.
+bool writeFile(const std::string& name, const std::string& data);
+
+bool createDirectory(const std::string& path);
 
 bool isDirectory(const std::string& path);
+bool isFile(const std::string& path);
 bool traverseDirectory(const std::string& path, const std::function<void(const std::string& name)>& callback);
 
 std::string joinPaths(const std::string& lhs, const std::string& rhs);
@@ -0,0 +1,134 @@
+// ModuleResolver.cpp : Maps require names to files, with search paths and a cache of found and missing modules.
+//
+
+#include "ModuleResolver.h"
+
+#include "Chunk.h"
+#include "FileUtils.h"
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <stdlib.h>
+
+struct ModuleResolver
+{
+    std::mutex mutex;
+
+    std::vector<std::string> searchPaths;
+    bool environmentLoaded = false;
+
+    // keyed by caller directory and name separated by a NUL, which neither can contain; a nullopt value caches a miss
+    std::unordered_map<std::string, std::optional<std::string>> cache;
+} gModuleResolver;
+
+void moduleResolverAddSearchPath(const std::string& path)
+{
+    std::unique_lock<std::mutex> lock(gModuleResolver.mutex);
+
+    gModuleResolver.searchPaths.push_back(path);
+    gModuleResolver.cache.clear();
+}
+
+// LUAM_PATH goes after the command line paths, so it's read on the first lookup rather than at startup
+static void loadEnvironmentLocked(ModuleResolver& resolver)
+{
+    if (resolver.environmentLoaded)
+        return;
+
+    resolver.environmentLoaded = true;
+
+    const char* list = getenv("LUAM_PATH");
+    if (!list)
+        return;
+
+    std::string paths = list;
+
+    for (size_t start = 0; start <= paths.size();)
+    {
+        size_t end = paths.find(';', start);
+        if (end == std::string::npos)
+            end = paths.size();
+
+        if (end > start)
+            resolver.searchPaths.push_back(paths.substr(start, end - start));
+
+        start = end + 1;
+    }
+}
+
+static bool isAbsolutePath(const std::string& path)
+{
+#ifdef _WIN32
+    if (path.size() >= 2 && path[1] == ':')
+        return true;
+#endif
+
+    return !path.empty() && (path[0] == '/' || path[0] == '\\');
+}
+
+static std::optional<std::string> findInDirectory(const std::string& directory, const std::string& name)
+{
+    std::string base = directory.empty() ? name : joinPaths(directory, name);
+
+    for (const char* extension : kRequireExtensions)
+        if (isFile(base + extension))
+            return base + extension;
+
+    std::string init = joinPaths(base, "init");
+
+    for (const char* extension : kRequireExtensions)
+        if (isFile(init + extension))
+            return init + extension;
+
+    return std::nullopt;
+}
+
+std::optional<std::string> moduleResolverResolve(const std::string& name, const std::string& callerDirectory)
+{
+    ModuleResolver& resolver = gModuleResolver;
+    std::string key = callerDirectory + '\0' + name;
+
+    std::vector<std::string> searchPaths;
+
+    {
+        std::unique_lock<std::mutex> lock(resolver.mutex);
+
+        auto it = resolver.cache.find(key);
+        if (it != resolver.cache.end())
+            return it->second;
+
+        loadEnvironmentLocked(resolver);
+        searchPaths = resolver.searchPaths;
+    }
+
+    std::optional<std::string> result;
+
+    if (isAbsolutePath(name))
+    {
+        result = findInDirectory("", name);
+    }
+    else
+    {
+        if (!callerDirectory.empty())
+            result = findInDirectory(callerDirectory, name);
+
+        if (!result)
+            result = findInDirectory("", name);
+
+        for (size_t i = 0; !result && i < searchPaths.size(); ++i)
+            result = findInDirectory(searchPaths[i], name);
+    }
+
+    std::unique_lock<std::mutex> lock(resolver.mutex);
+    resolver.cache[key] = result;
+
+    return result;
+}
+
+void moduleResolverClearCache()
+{
+    std::unique_lock<std::mutex> lock(gModuleResolver.mutex);
+    gModuleResolver.cache.clear();
+}
@@ -0,0 +1,20 @@
+// ModuleResolver.h : Maps require names to files, with search paths and a cache of found and missing modules.
+//
+
+#pragma once
+
+#include <optional>
+#include <string>
+
+// Adds a directory that is searched after the requiring script's directory and the working directory (--require-path).
+void moduleResolverAddSearchPath(const std::string& path);
+
+// Resolves require(name) for a chunk loaded from callerDirectory ("" when it didn't come from a file). The caller's
+// directory, the working directory and then the search paths (--require-path, followed by the ';' separated
+// LUAM_PATH environment variable) are tried in order; in each, name + .luac/.luam/.lua is tried first and then a
+// directory module, name/init + .luac/.luam/.lua. Every lookup, successful or not, is cached until the cache is
+// cleared, so each candidate is only checked on disk once.
+std::optional<std::string> moduleResolverResolve(const std::string& name, const std::string& callerDirectory);
+
+// Forgets every cached lookup, e.g. after files were added or removed.
+void moduleResolverClearCache();
@@ -0,0 +1,29 @@
+// Output.cpp : stdout/stderr writes that can be captured per thread.
+//
+
+#include "Output.h"
+
+#include <stdio.h>
+
+static thread_local OutputCapture* gOutputCapture = nullptr;
+
+void setOutputCapture(OutputCapture* capture)
+{
+    gOutputCapture = capture;
+}
+
+void writeOutput(const char* s, size_t l)
+{
+    if (gOutputCapture)
+        gOutputCapture->out.append(s, l);
+    else
+        fwrite(s, 1, l, stdout);
+}
+
+void writeError(const char* s, size_t l)
+{
+    if (gOutputCapture)
+        gOutputCapture->err.append(s, l);
+    else
+        fwrite(s, 1, l, stderr);
+}
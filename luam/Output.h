@@ -0,0 +1,30 @@
+// Output.h : stdout/stderr writes that can be captured per thread.
+//
+
+#pragma once
+
+#include <string>
+
+#include <stddef.h>
+
+struct OutputCapture
+{
+    std::string out;
+    std::string err;
+};
+
+// Redirects everything the calling thread writes through writeOutput/writeError into capture; nullptr restores stdout/stderr.
+void setOutputCapture(OutputCapture* capture);
+
+void writeOutput(const char* s, size_t l);
+void writeError(const char* s, size_t l);
+
+inline void writeOutput(const std::string& s)
+{
+    writeOutput(s.data(), s.size());
+}
+
+inline void writeError(const std::string& s)
+{
+    writeError(s.data(), s.size());
+}
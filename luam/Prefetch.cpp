@@ -0,0 +1,187 @@
+// Prefetch.cpp : Compiles the modules a script requires in parallel before the script runs.
+//
+
+#include "Prefetch.h"
+
+#include "Chunk.h"
+#include "Dependencies.h"
+#include "FileUtils.h"
+#include "ModuleResolver.h"
+
+#include "Luau/Compiler.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// runs that are running at the same time (--jobs) share the modules they have in common; an entry lives until every run
+// that prefetched it is done
+struct PrefetchEntry
+{
+    std::string bytecode;
+    bool compiled = false;
+    int runs = 0;
+};
+
+struct PrefetchStore
+{
+    std::mutex mutex;
+    std::unordered_map<std::string, PrefetchEntry> entries; // by resolved path
+} gPrefetchStore;
+
+// discovery and compilation share one queue: a worker reads a file, queues the modules it requires and compiles it
+struct PrefetchQueue
+{
+    std::mutex mutex;
+    std::condition_variable changed;
+
+    std::deque<std::string> pending;
+    std::unordered_set<std::string> seen;
+    int active = 0;
+};
+
+static void queueRequires(PrefetchQueue& queue, const std::string& path, const std::string& source)
+{
+    std::vector<std::string> names;
+    if (!findRequires(source, names))
+        return; // require reports the syntax error when the module is actually loaded
+
+    std::string directory = getParentPath(path).value_or(std::string());
+
+    for (const std::string& name : names)
+    {
+        std::optional<std::string> resolved = moduleResolverResolve(name, directory);
+        if (!resolved)
+            continue;
+
+        std::unique_lock<std::mutex> lock(queue.mutex);
+
+        if (queue.seen.insert(*resolved).second)
+        {
+            queue.pending.push_back(*resolved);
+            queue.changed.notify_one();
+        }
+    }
+}
+
+static void prefetchWorker(PrefetchQueue& queue, const std::string& entry, const Luau::CompileOptions& options)
+{
+    std::unique_lock<std::mutex> lock(queue.mutex);
+
+    for (;;)
+    {
+        queue.changed.wait(lock, [&queue] { return !queue.pending.empty() || queue.active == 0; });
+
+        if (queue.pending.empty())
+            return;
+
+        std::string path = queue.pending.front();
+        queue.pending.pop_front();
+        queue.active++;
+
+        lock.unlock();
+
+        if (std::optional<std::string> data = readFile(path))
+        {
+            if (getChunkKind(*data) == ChunkKind::Source)
+                queueRequires(queue, path, *data);
+
+            // the entry is compiled by runFile itself
+            bool compile = false;
+
+            if (path != entry)
+            {
+                std::unique_lock<std::mutex> storeLock(gPrefetchStore.mutex);
+                PrefetchEntry& stored = gPrefetchStore.entries[path];
+
+                stored.runs++;
+                compile = !stored.compiled;
+            }
+
+            std::string bytecode;
+            std::string error;
+
+            if (compile && chunkFileToBytecode(path, *data, options, bytecode, error))
+            {
+                std::unique_lock<std::mutex> storeLock(gPrefetchStore.mutex);
+                PrefetchEntry& stored = gPrefetchStore.entries[path];
+
+                stored.bytecode = std::move(bytecode);
+                stored.compiled = true;
+            }
+        }
+
+        lock.lock();
+        queue.active--;
+
+        // the last active worker running dry lets everyone else exit
+        if (queue.active == 0 && queue.pending.empty())
+            queue.changed.notify_all();
+    }
+}
+
+std::vector<std::string> prefetchModules(const std::string& entry, const Luau::CompileOptions& options, int threads)
+{
+    PrefetchQueue queue;
+    queue.pending.push_back(entry);
+    queue.seen.insert(entry);
+
+    std::vector<std::thread> workers;
+
+    for (int i = 0; i < std::max(threads, 1); ++i)
+        workers.emplace_back(prefetchWorker, std::ref(queue), std::cref(entry), std::cref(options));
+
+    for (std::thread& worker : workers)
+        worker.join();
+
+    // every module but the entry was registered with the store by the worker that read it
+    queue.seen.erase(entry);
+
+    return std::vector<std::string>(queue.seen.begin(), queue.seen.end());
+}
+
+std::optional<std::string> prefetchTake(const std::string& path)
+{
+    std::unique_lock<std::mutex> lock(gPrefetchStore.mutex);
+
+    auto it = gPrefetchStore.entries.find(path);
+    if (it == gPrefetchStore.entries.end() || !it->second.compiled)
+        return std::nullopt;
+
+    // other runs may still require it, the last one can have the bytecode without a copy
+    if (it->second.runs > 1)
+        return it->second.bytecode;
+
+    it->second.compiled = false;
+    return std::move(it->second.bytecode);
+}
+
+void prefetchInvalidate(const std::string& path)
+{
+    std::unique_lock<std::mutex> lock(gPrefetchStore.mutex);
+
+    auto it = gPrefetchStore.entries.find(path);
+    if (it == gPrefetchStore.entries.end())
+        return;
+
+    it->second.bytecode.clear();
+    it->second.compiled = false;
+}
+
+void prefetchDiscard(const std::vector<std::string>& paths)
+{
+    std::unique_lock<std::mutex> lock(gPrefetchStore.mutex);
+
+    for (const std::string& path : paths)
+    {
+        auto it = gPrefetchStore.entries.find(path);
+
+        if (it != gPrefetchStore.entries.end() && --it->second.runs <= 0)
+            gPrefetchStore.entries.erase(it);
+    }
+}
@@ -0,0 +1,29 @@
+// Prefetch.h : Compiles the modules a script requires in parallel before the script runs.
+//
+
+#pragma once
+
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace Luau
+{
+struct CompileOptions;
+}
+
+// Finds the modules entry requires with constant names, transitively, resolving them the way require does, and
+// compiles them on the given number of threads. The bytecode is kept until require loads the module, so the script
+// runs exactly as before, only without compiling on its critical path. Returns the paths of the modules it found; they
+// stay in the store until they are passed to prefetchDiscard once the run is over, so a require after a wait still
+// finds them. Runs that prefetch the same module at the same time share one copy.
+std::vector<std::string> prefetchModules(const std::string& entry, const Luau::CompileOptions& options, int threads);
+
+// Hands out the prefetched bytecode of the module at the resolved path.
+std::optional<std::string> prefetchTake(const std::string& path);
+
+// Drops the bytecode of a module whose file changed; runs that still need it compile it on demand.
+void prefetchInvalidate(const std::string& path);
+
+// Ends a run's interest in the modules prefetchModules returned for it; a module is forgotten once no run needs it.
+void prefetchDiscard(const std::vector<std::string>& paths);
@@ -3,16 +3,91 @@
 
 #include "Luau/DenseHash.h"
 
-#include <thread>
+#include "Clock.h"
+#include "Output.h"
+#include "ProfilerFormats.h"
+#include "TextFormat.h"
+
+#include <algorithm>
 #include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+// frames are interned by content: source, name and line. The strings a proto owns are a cache in front of that, so a
+// sample usually doesn't have to format anything; once a chunk is collected its strings' addresses can be reused by
+// another function's, so a cached frame is only used while its contents still match
+struct ProfilerFrameKey
+{
+    const char* source = nullptr;
+    const char* name = nullptr;
+    int linedefined = 0;
+
+    bool operator==(const ProfilerFrameKey& other) const
+    {
+        return source == other.source && name == other.name && linedefined == other.linedefined;
+    }
+};
+
+struct ProfilerFrameKeyHash
+{
+    size_t operator()(const ProfilerFrameKey& key) const
+    {
+        size_t hash = std::hash<const void*>()(key.source);
+        hash = hash * 31 + std::hash<const void*>()(key.name);
+        hash = hash * 31 + std::hash<int>()(key.linedefined);
+        return hash;
+    }
+};
+
+static const uint32_t kProfilerRoot = 0;
+static const uint32_t kProfilerGCFrame = 0;
+
+// number of tasks profilerDump lists, by time spent
+static const size_t kProfilerTaskReport = 10;
+
+extern const char* luaC_statename(int state);
+
+// every VM that was set up; they're all sampled while the profiler runs
+struct ProfilerState
+{
+    lua_Callbacks* callbacks = nullptr;
+    uint64_t currentTicks = 0; // ticks at the state's previous sample
+    uint64_t armedTicks = 0;   // ticks when the interrupt that takes the next sample was armed
+};
 
 struct Profiler
 {
+    // start and stop may come from any VM's thread and from the signal thread; control is held across the whole of
+    // either, including joining the sampler thread, so a start never replaces a thread that is still being joined
+    std::mutex control;
+
     // static state
-    lua_Callbacks* callbacks = nullptr;
     int frequency = 1000;
     std::thread thread;
+    bool running = false;
+
+    // guards everything below; the sampler thread sleeps on wakeUp between samples, stopping wakes it up, and the
+    // triggers of VMs running on different threads take turns recording their samples
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    std::vector<ProfilerState> states;
 
     // variables for communication between loop and trigger
     std::atomic<bool> exit = false;
@@ -20,46 +95,141 @@ struct Profiler
     std::atomic<uint64_t> samples = 0;
 
     // private state for trigger
-    uint64_t currentTicks = 0;
-    std::string stackScratch;
+    std::vector<uint32_t> stackScratch; // frame ids, innermost first
+
+    // statistics, updated by trigger; frames and the call stack trie
+    ProfileData data = {{{ProfileFrameKind::GC, "GC", "GC", 0}}};
+    Luau::DenseHashMap<ProfilerFrameKey, uint32_t, ProfilerFrameKeyHash> frameIds{ProfilerFrameKey()};
+    std::unordered_map<std::string, uint32_t> frameContents; // short_src, name and line separated by NULs -> frame
+    Luau::DenseHashMap<uint64_t, uint32_t> children{~0ull}; // parent << 32 | frame -> node
 
-    // statistics, updated by trigger
-    Luau::DenseHashMap<std::string, uint64_t> data{""};
     uint64_t gc[16] = {};
+    uint32_t gcFrames[16] = {}; // frame id of every GC state seen so far, 0 until then
+
+    // a profile started by a script or SIGUSR1 may still be running when the process exits, and destroying a thread
+    // that wasn't joined terminates the process
+    ~Profiler()
+    {
+        std::unique_lock<std::mutex> controlLock(control);
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            exit = true;
+            wakeUp.notify_one();
+        }
+
+        if (thread.joinable())
+            thread.join();
+    }
 } gProfiler;
 
+static uint32_t internFrame(const lua_Debug& ar)
+{
+    ProfilerFrameKey key = {ar.source, ar.name, ar.linedefined};
+    const char* name = ar.name ? ar.name : "";
+
+    uint32_t& cached = gProfiler.frameIds[key];
+
+    if (cached != 0)
+    {
+        const ProfileFrame& frame = gProfiler.data.frames[cached];
+
+        if (frame.source == ar.short_src && frame.name == name)
+            return cached;
+    }
+
+    std::string contents = std::string(ar.short_src) + '\0' + name + '\0' + std::to_string(ar.linedefined);
+
+    auto [it, inserted] = gProfiler.frameContents.try_emplace(std::move(contents), uint32_t(gProfiler.data.frames.size()));
+
+    if (inserted)
+        gProfiler.data.frames.push_back({ProfileFrameKind::Function, ar.short_src, name, ar.linedefined});
+
+    cached = it->second;
+    return cached;
+}
+
+static uint32_t internGCFrame(int state)
+{
+    uint32_t& id = gProfiler.gcFrames[state];
+
+    if (id == 0)
+    {
+        id = uint32_t(gProfiler.data.frames.size());
+        gProfiler.data.frames.push_back({ProfileFrameKind::GCState, "GC", luaC_statename(state), 0});
+    }
+
+    return id;
+}
+
+static uint32_t childNode(uint32_t parent, uint32_t frame)
+{
+    uint64_t key = (uint64_t(parent) << 32) | frame;
+
+    if (const uint32_t* node = gProfiler.children.find(key))
+        return *node;
+
+    uint32_t node = uint32_t(gProfiler.data.nodes.size());
+    gProfiler.data.nodes.push_back({frame, parent, 0, 0});
+    gProfiler.children[key] = node;
+    return node;
+}
+
+static ProfilerState* findState(lua_Callbacks* callbacks)
+{
+    for (ProfilerState& state : gProfiler.states)
+        if (state.callbacks == callbacks)
+            return &state;
+
+    return nullptr;
+}
+
 static void profilerTrigger(lua_State* L, int gc)
 {
+    lua_Callbacks* callbacks = lua_callbacks(L);
+
+    if (callbacks->interrupt == profilerTrigger)
+        callbacks->interrupt = nullptr;
+
+    std::unique_lock<std::mutex> lock(gProfiler.mutex);
+
+    ProfilerState* state = findState(callbacks);
+    if (!state)
+        return;
+
+    // a VM that is asleep in the event loop takes the sample when it wakes up; the time it slept isn't its own, so it
+    // is only charged up to the point the interrupt was armed
     uint64_t currentTicks = gProfiler.ticks.load();
-    uint64_t elapsedTicks = currentTicks - gProfiler.currentTicks;
+    uint64_t elapsedTicks = state->armedTicks > state->currentTicks ? state->armedTicks - state->currentTicks : 0;
 
     if (elapsedTicks)
     {
-        std::string& stack = gProfiler.stackScratch;
+        std::vector<uint32_t>& stack = gProfiler.stackScratch;
 
         stack.clear();
 
         if (gc > 0)
-            stack += "GC,GC,";
+        {
+            stack.push_back(internGCFrame(gc));
+            stack.push_back(kProfilerGCFrame);
+        }
 
+        // L is the coroutine that is running, so the outermost frame is the function the task or coroutine started
+        // with (a delay/spawn callback, a module or the main chunk); it becomes the trie's first level, which is what
+        // the per-task totals are taken from
         lua_Debug ar;
         for (int level = 0; lua_getinfo(L, level, "sn", &ar); ++level)
-        {
-            if (!stack.empty())
-                stack += ';';
-
-            stack += ar.short_src;
-            stack += ',';
-            if (ar.name)
-                stack += ar.name;
-            stack += ',';
-            if (ar.linedefined > 0)
-                stack += std::to_string(ar.linedefined);
-        }
+            stack.push_back(internFrame(ar));
 
         if (!stack.empty())
         {
-            gProfiler.data[stack] += elapsedTicks;
+            uint32_t node = kProfilerRoot;
+
+            for (size_t i = stack.size(); i > 0; --i)
+                node = childNode(node, stack[i - 1]);
+
+            gProfiler.data.nodes[node].ticks += elapsedTicks;
+            gProfiler.data.nodes[node].samples++;
         }
 
         if (gc > 0)
@@ -68,71 +238,193 @@ static void profilerTrigger(lua_State* L, int gc)
         }
     }
 
-    gProfiler.currentTicks = currentTicks;
-    gProfiler.callbacks->interrupt = nullptr;
+    state->currentTicks = currentTicks;
+}
+
+// xorshift, the jitter only has to break up the phase between samples and periodic work in the script
+static uint64_t nextJitter(uint64_t& state)
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
 }
 
 static void profilerLoop()
 {
-    double last = lua_clock();
+    uint64_t period = std::max(uint64_t(1e9 / double(gProfiler.frequency)), uint64_t(1));
+    uint64_t jitter = clockNanoseconds() | 1;
+
+    uint64_t last = clockNanoseconds();
+    uint64_t next = last;
+
+    std::unique_lock<std::mutex> lock(gProfiler.mutex);
 
     while (!gProfiler.exit)
     {
-        double now = lua_clock();
+        // sleep for 0.5-1.5 periods; samples are weighted by the time that actually passed, so the jitter doesn't skew totals
+        next += period / 2 + nextJitter(jitter) % period;
 
-        if (now - last >= 1.0 / double(gProfiler.frequency))
-        {
-            int64_t ticks = int64_t((now - last) * 1e6);
+        gProfiler.wakeUp.wait_until(lock, clockToTimePoint(next), [] { return gProfiler.exit.load(); });
 
-            gProfiler.ticks += ticks;
-            gProfiler.samples++;
-            gProfiler.callbacks->interrupt = profilerTrigger;
+        if (gProfiler.exit)
+            break;
 
-            last += ticks * 1e-6;
-        }
-        else
+        uint64_t now = clockNanoseconds();
+        uint64_t ticks = (now - last) / 1000;
+
+        gProfiler.ticks += ticks;
+        gProfiler.samples++;
+
+        // an interrupt that's already set (Ctrl-C, tiered codegen) is left alone, that state skips this sample; one
+        // that is still armed belongs to a state that hasn't run since, which keeps its original arming time
+        for (ProfilerState& state : gProfiler.states)
         {
-            std::this_thread::yield();
+            if (!state.callbacks->interrupt)
+            {
+                state.callbacks->interrupt = profilerTrigger;
+                state.armedTicks = gProfiler.ticks.load();
+            }
+            else if (state.callbacks->interrupt != profilerTrigger)
+            {
+                state.currentTicks = gProfiler.ticks.load();
+            }
         }
+
+        last += ticks * 1000;
+
+        // after a stall (suspended process, overloaded host) the schedule restarts instead of sampling in a burst
+        if (next < now)
+            next = now;
     }
 }
 
-void profilerStart(lua_State* L, int frequency)
+void profilerAttach(lua_State* L)
+{
+    std::unique_lock<std::mutex> lock(gProfiler.mutex);
+
+    lua_Callbacks* callbacks = lua_callbacks(L);
+
+    if (!findState(callbacks))
+        gProfiler.states.push_back({callbacks, gProfiler.ticks.load(), gProfiler.ticks.load()});
+}
+
+void profilerDetach(lua_State* L)
 {
-    gProfiler.frequency = frequency;
-    gProfiler.callbacks = lua_callbacks(L);
+    std::unique_lock<std::mutex> lock(gProfiler.mutex);
+
+    lua_Callbacks* callbacks = lua_callbacks(L);
+
+    if (callbacks->interrupt == profilerTrigger)
+        callbacks->interrupt = nullptr;
+
+    gProfiler.states.erase(std::remove_if(gProfiler.states.begin(), gProfiler.states.end(),
+                               [callbacks](const ProfilerState& state) {
+                                   return state.callbacks == callbacks;
+                               }),
+        gProfiler.states.end());
+}
+
+void profilerStart(int frequency)
+{
+    std::unique_lock<std::mutex> control(gProfiler.control);
+    std::unique_lock<std::mutex> lock(gProfiler.mutex);
+
+    if (gProfiler.running)
+        return;
+
+    gProfiler.frequency = std::max(frequency, 1);
+    gProfiler.running = true;
+
+    // time from before the start isn't charged to anyone
+    for (ProfilerState& state : gProfiler.states)
+        state.currentTicks = state.armedTicks = gProfiler.ticks.load();
 
     gProfiler.exit = false;
     gProfiler.thread = std::thread(profilerLoop);
 }
 
+bool profilerRunning()
+{
+    std::unique_lock<std::mutex> lock(gProfiler.mutex);
+    return gProfiler.running;
+}
+
+void profilerReset()
+{
+    std::unique_lock<std::mutex> lock(gProfiler.mutex);
+
+    gProfiler.data.frames.resize(1); // the GC frame
+    gProfiler.data.nodes.resize(1);  // the root
+    gProfiler.frameIds.clear();
+    gProfiler.frameContents.clear();
+    gProfiler.children.clear();
+
+    std::fill(std::begin(gProfiler.gc), std::end(gProfiler.gc), 0);
+    std::fill(std::begin(gProfiler.gcFrames), std::end(gProfiler.gcFrames), 0);
+
+    gProfiler.data.nodes[kProfilerRoot] = ProfileNode();
+    gProfiler.samples = 0;
+
+    for (ProfilerState& state : gProfiler.states)
+        state.currentTicks = state.armedTicks = gProfiler.ticks.load();
+}
+
 void profilerStop()
 {
-    gProfiler.exit = true;
+    std::unique_lock<std::mutex> control(gProfiler.control);
+
+    {
+        std::unique_lock<std::mutex> lock(gProfiler.mutex);
+
+        if (!gProfiler.running)
+            return;
+
+        gProfiler.running = false;
+        gProfiler.exit = true;
+        gProfiler.wakeUp.notify_one();
+    }
+
     gProfiler.thread.join();
 }
 
-void profilerDump(const char* path)
+void profilerDump(const char* path, ProfileFormat format)
 {
     FILE* f = fopen(path, "wb");
     if (!f)
     {
-        fprintf(stderr, "Error opening profile %s\n", path);
+        writeError("Error opening profile " + std::string(path) + "\n");
         return;
     }
 
+    std::unique_lock<std::mutex> lock(gProfiler.mutex);
+
+    gProfiler.data.frequency = gProfiler.frequency;
+
+    std::string contents = profileWrite(gProfiler.data, format);
+    fwrite(contents.data(), 1, contents.size(), f);
+    fclose(f);
+
     uint64_t total = 0;
+    uint64_t stacks = 0;
 
-    for (auto& p : gProfiler.data)
+    for (const ProfileNode& node : gProfiler.data.nodes)
     {
-        fprintf(f, "%lld %s\n", static_cast<long long>(p.second), p.first.c_str());
-        total += p.second;
+        total += node.ticks;
+        stacks += node.ticks != 0;
     }
 
-    fclose(f);
+    // the summary goes through writeOutput, so under --jobs it stays in order with the output of the files
+    std::string summary;
+
+    appendFormat(summary, "Profiler dump written to %s (total runtime %.3f seconds, %lld samples, %lld stacks)\n", path, double(total) / 1e6,
+        static_cast<long long>(gProfiler.samples.load()), static_cast<long long>(stacks));
+
+    std::vector<ProfileTask> tasks = profileTasks(gProfiler.data);
 
-    printf("Profiler dump written to %s (total runtime %.3f seconds, %lld samples, %lld stacks)\n", path, double(total) / 1e6,
-        static_cast<long long>(gProfiler.samples.load()), static_cast<long long>(gProfiler.data.size()));
+    for (size_t i = 0; i < tasks.size() && i < kProfilerTaskReport; ++i)
+        appendFormat(summary, "%s %8.3f s %6.2f%%  %s\n", i == 0 ? "Tasks:" : "      ", double(tasks[i].ticks) / 1e6,
+            double(tasks[i].ticks) / double(total) * 100, profileFrameLabel(gProfiler.data.frames[tasks[i].frame]).c_str());
 
     uint64_t totalgc = 0;
     for (uint64_t p : gProfiler.gc)
@@ -140,18 +432,127 @@ void profilerDump(const char* path)
 
     if (totalgc)
     {
-        printf("GC: %.3f seconds (%.2f%%)", double(totalgc) / 1e6, double(totalgc) / double(total) * 100);
+        appendFormat(summary, "GC: %.3f seconds (%.2f%%)", double(totalgc) / 1e6, double(totalgc) / double(total) * 100);
 
         for (size_t i = 0; i < std::size(gProfiler.gc); ++i)
         {
-            extern const char* luaC_statename(int state);
-
             uint64_t p = gProfiler.gc[i];
 
             if (p)
-                printf(", %s %.2f%%", luaC_statename(int(i)), double(p) / double(totalgc) * 100);
+                appendFormat(summary, ", %s %.2f%%", luaC_statename(int(i)), double(p) / double(totalgc) * 100);
         }
 
-        printf("\n");
+        summary += "\n";
     }
+
+    writeOutput(summary);
+}
+
+// profile-<pid>-<local time>.<extension of the format's default file>
+static std::string timestampedPath(ProfileFormat format)
+{
+    std::string path = profileDefaultPath(format);
+
+    time_t now = time(nullptr);
+    struct tm local = {};
+#ifdef _WIN32
+    localtime_s(&local, &now);
+    int pid = int(GetCurrentProcessId());
+#else
+    localtime_r(&now, &local);
+    int pid = int(getpid());
+#endif
+
+    char stamp[64];
+    snprintf(stamp, sizeof(stamp), "-%d-%04d%02d%02d-%02d%02d%02d", pid, local.tm_year + 1900, local.tm_mon + 1, local.tm_mday, local.tm_hour,
+        local.tm_min, local.tm_sec);
+
+    path.insert(path.find('.'), stamp);
+    return path;
+}
+
+#ifndef _WIN32
+// the handler only writes the signal to a pipe, the thread reading it does the actual work outside of signal context
+static int gProfilerSignalPipe[2] = {-1, -1};
+static std::thread gProfilerSignalThread;
+
+// the write end doesn't block, a burst of signals that fills the pipe simply loses the ones that don't fit
+static void profilerSignalHandler(int signum)
+{
+    int savedErrno = errno;
+
+    char command = char(signum == SIGUSR1 ? '1' : '2');
+    ssize_t written = write(gProfilerSignalPipe[1], &command, 1);
+    (void)written;
+
+    errno = savedErrno;
+}
+
+static void profilerSignalLoop(int frequency, ProfileFormat format)
+{
+    for (;;)
+    {
+        char command = 0;
+        ssize_t length = read(gProfilerSignalPipe[0], &command, 1);
+
+        if (length < 0 && errno == EINTR)
+            continue;
+
+        if (length != 1)
+            return;
+
+        if (command == '1' && !profilerRunning())
+        {
+            profilerReset();
+            profilerStart(frequency);
+        }
+        else if (command == '2' && profilerRunning())
+        {
+            profilerStop();
+            profilerDump(timestampedPath(format).c_str(), format);
+        }
+    }
+}
+
+// runs at exit, before gProfiler is destroyed: signals from here on are ignored and closing the write end lets the
+// signal thread see the end of the pipe
+static void profilerCloseSignals()
+{
+    signal(SIGUSR1, SIG_IGN);
+    signal(SIGUSR2, SIG_IGN);
+
+    close(gProfilerSignalPipe[1]);
+
+    if (gProfilerSignalThread.joinable())
+        gProfilerSignalThread.join();
+
+    close(gProfilerSignalPipe[0]);
+}
+#endif
+
+void profilerHandleSignals(int frequency, ProfileFormat format)
+{
+#ifndef _WIN32
+    if (gProfilerSignalPipe[0] >= 0 || pipe(gProfilerSignalPipe) != 0)
+        return;
+
+    fcntl(gProfilerSignalPipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(gProfilerSignalPipe[1], F_SETFD, FD_CLOEXEC);
+    fcntl(gProfilerSignalPipe[1], F_SETFL, fcntl(gProfilerSignalPipe[1], F_GETFL) | O_NONBLOCK);
+
+    // blocked on the pipe until profilerCloseSignals closes it at exit
+    gProfilerSignalThread = std::thread(profilerSignalLoop, frequency, format);
+    atexit(profilerCloseSignals);
+
+    struct sigaction action = {};
+    action.sa_handler = profilerSignalHandler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+
+    sigaction(SIGUSR1, &action, nullptr);
+    sigaction(SIGUSR2, &action, nullptr);
+#else
+    (void)frequency;
+    (void)format;
+#endif
 }
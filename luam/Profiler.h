@@ -1,8 +1,23 @@
 // This file is part of the Luau programming language and is licensed under MIT License; see LICENSE.txt for details
 #pragma once
 
+#include "ProfilerFormats.h"
+
 struct lua_State;
 
-void profilerStart(lua_State* L, int frequency);
+// Every state registers itself as it's set up and leaves as it's closed; while the profiler runs, all registered states
+// are sampled into one profile.
+void profilerAttach(lua_State* L);
+void profilerDetach(lua_State* L);
+
+// Starting a running profiler or stopping a stopped one does nothing; samples keep adding up across runs until reset.
+void profilerStart(int frequency);
 void profilerStop();
-void profilerDump(const char* path);
+bool profilerRunning();
+// Discards everything sampled so far.
+void profilerReset();
+void profilerDump(const char* path, ProfileFormat format = ProfileFormat::Collapsed);
+
+// SIGUSR1 starts sampling every state at the given frequency with a fresh profile, SIGUSR2 stops it and writes it to
+// profile-<pid>-<time> with the format's extension. POSIX only, does nothing on Windows.
+void profilerHandleSignals(int frequency, ProfileFormat format);
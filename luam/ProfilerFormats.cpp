@@ -0,0 +1,564 @@
+// ProfilerFormats.cpp : Writes the profiler's call stack trie as collapsed stacks, pprof, speedscope, an SVG flame graph
+// or a Chrome trace.
+//
+
+#include "ProfilerFormats.h"
+
+#include "TextFormat.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+#include <string.h>
+
+struct ProfileFormatInfo
+{
+    const char* name;
+    ProfileFormat format;
+    const char* path;
+};
+
+static const ProfileFormatInfo kProfileFormats[] = {
+    {"collapsed", ProfileFormat::Collapsed, "profile.out"},
+    {"pprof", ProfileFormat::Pprof, "profile.pb"},
+    {"speedscope", ProfileFormat::Speedscope, "profile.speedscope.json"},
+    {"svg", ProfileFormat::Svg, "profile.svg"},
+    {"chrome", ProfileFormat::ChromeTrace, "profile.trace.json"},
+};
+
+bool profileParseFormat(const char* name, ProfileFormat& format)
+{
+    for (const ProfileFormatInfo& info : kProfileFormats)
+    {
+        if (strcmp(info.name, name) == 0)
+        {
+            format = info.format;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const char* profileDefaultPath(ProfileFormat format)
+{
+    for (const ProfileFormatInfo& info : kProfileFormats)
+        if (info.format == format)
+            return info.path;
+
+    return "profile.out";
+}
+
+static std::string frameName(const ProfileFrame& frame)
+{
+    if (frame.kind == ProfileFrameKind::GCState)
+        return "GC " + frame.name;
+
+    return frame.name.empty() ? "anonymous" : frame.name;
+}
+
+std::string profileFrameLabel(const ProfileFrame& frame)
+{
+    std::string label = frameName(frame);
+
+    if (frame.kind == ProfileFrameKind::Function)
+    {
+        label += " (";
+        label += frame.source;
+        if (frame.linedefined > 0)
+            label += ":" + std::to_string(frame.linedefined);
+        label += ")";
+    }
+
+    return label;
+}
+
+// the first level node every node is under, 0 for the root
+static std::vector<uint32_t> taskNodes(const ProfileData& data)
+{
+    std::vector<uint32_t> tasks(data.nodes.size());
+
+    for (size_t i = 1; i < data.nodes.size(); ++i)
+    {
+        uint32_t parent = data.nodes[i].parent;
+        tasks[i] = parent == 0 ? uint32_t(i) : tasks[parent];
+    }
+
+    return tasks;
+}
+
+std::vector<ProfileTask> profileTasks(const ProfileData& data)
+{
+    std::vector<uint32_t> tasks = taskNodes(data);
+    std::vector<ProfileTask> result;
+    std::vector<size_t> index(data.nodes.size(), ~size_t(0));
+
+    for (size_t i = 1; i < data.nodes.size(); ++i)
+    {
+        const ProfileNode& node = data.nodes[i];
+        if (node.ticks == 0)
+            continue;
+
+        uint32_t task = tasks[i];
+
+        if (index[task] == ~size_t(0))
+        {
+            index[task] = result.size();
+            result.push_back({data.nodes[task].frame, 0, 0});
+        }
+
+        result[index[task]].ticks += node.ticks;
+        result[index[task]].samples += node.samples;
+    }
+
+    std::sort(result.begin(), result.end(), [](const ProfileTask& a, const ProfileTask& b) {
+        return a.ticks > b.ticks;
+    });
+
+    return result;
+}
+
+static uint64_t totalTicks(const ProfileData& data)
+{
+    uint64_t total = 0;
+    for (const ProfileNode& node : data.nodes)
+        total += node.ticks;
+    return total;
+}
+
+static std::string writeCollapsed(const ProfileData& data)
+{
+    std::string result;
+    std::string stack;
+
+    for (const ProfileNode& node : data.nodes)
+    {
+        if (node.ticks == 0)
+            continue;
+
+        stack.clear();
+
+        for (const ProfileNode* frame = &node; frame != &data.nodes[0]; frame = &data.nodes[frame->parent])
+        {
+            const ProfileFrame& info = data.frames[frame->frame];
+
+            if (info.kind == ProfileFrameKind::GCState)
+                continue;
+
+            if (!stack.empty())
+                stack += ';';
+
+            stack += info.source;
+            stack += ',';
+            stack += info.name;
+            stack += ',';
+            if (info.linedefined > 0)
+                stack += std::to_string(info.linedefined);
+        }
+
+        appendFormat(result, "%lld ", static_cast<long long>(node.ticks));
+        result += stack;
+        result += '\n';
+    }
+
+    return result;
+}
+
+// just enough of the protobuf wire format for profile.proto
+struct ProtoWriter
+{
+    std::string data;
+
+    void varint(uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            data += char(value | 0x80);
+            value >>= 7;
+        }
+
+        data += char(value);
+    }
+
+    void integer(int field, uint64_t value)
+    {
+        varint(uint64_t(field) << 3);
+        varint(value);
+    }
+
+    void bytes(int field, const std::string& value)
+    {
+        varint((uint64_t(field) << 3) | 2);
+        varint(value.size());
+        data += value;
+    }
+
+    void packed(int field, const std::vector<uint64_t>& values)
+    {
+        ProtoWriter list;
+        for (uint64_t value : values)
+            list.varint(value);
+
+        bytes(field, list.data);
+    }
+};
+
+struct ProtoStrings
+{
+    std::vector<std::string> table = {""};
+    std::unordered_map<std::string, uint64_t> ids = {{"", 0}};
+
+    uint64_t operator()(const std::string& value)
+    {
+        auto [it, inserted] = ids.emplace(value, table.size());
+        if (inserted)
+            table.push_back(value);
+
+        return it->second;
+    }
+};
+
+static std::string writePprof(const ProfileData& data)
+{
+    ProtoWriter profile;
+    ProtoStrings strings;
+
+    auto valueType = [&strings](const char* type, const char* unit) {
+        ProtoWriter message;
+        message.integer(1, strings(type));
+        message.integer(2, strings(unit));
+        return message.data;
+    };
+
+    profile.bytes(1, valueType("samples", "count"));
+    profile.bytes(1, valueType("cpu", "microseconds"));
+
+    // samples list their locations innermost first, like the trie paths
+    std::vector<uint64_t> locations;
+    std::vector<uint32_t> tasks = taskNodes(data);
+
+    for (size_t i = 1; i < data.nodes.size(); ++i)
+    {
+        const ProfileNode& node = data.nodes[i];
+        if (node.ticks == 0 && node.samples == 0)
+            continue;
+
+        locations.clear();
+        for (const ProfileNode* frame = &node; frame != &data.nodes[0]; frame = &data.nodes[frame->parent])
+            locations.push_back(frame->frame + 1);
+
+        ProtoWriter label;
+        label.integer(1, strings("task"));
+        label.integer(2, strings(profileFrameLabel(data.frames[data.nodes[tasks[i]].frame])));
+
+        ProtoWriter sample;
+        sample.packed(1, locations);
+        sample.packed(2, {node.samples, node.ticks});
+        sample.bytes(3, label.data);
+        profile.bytes(2, sample.data);
+    }
+
+    // one location and one function per frame, both with the frame id + 1 as their id since 0 is reserved
+    for (size_t i = 0; i < data.frames.size(); ++i)
+    {
+        ProtoWriter line;
+        line.integer(1, i + 1);
+        line.integer(2, uint64_t(std::max(data.frames[i].linedefined, 0)));
+
+        ProtoWriter location;
+        location.integer(1, i + 1);
+        location.bytes(4, line.data);
+        profile.bytes(4, location.data);
+    }
+
+    for (size_t i = 0; i < data.frames.size(); ++i)
+    {
+        const ProfileFrame& frame = data.frames[i];
+
+        ProtoWriter function;
+        function.integer(1, i + 1);
+        function.integer(2, strings(frameName(frame)));
+        function.integer(3, strings(frameName(frame)));
+        function.integer(4, strings(frame.kind == ProfileFrameKind::Function ? frame.source : std::string()));
+        function.integer(5, uint64_t(std::max(frame.linedefined, 0)));
+        profile.bytes(5, function.data);
+    }
+
+    // the string table has to be complete, so it goes after everything that interns strings
+    std::string periodType = valueType("cpu", "microseconds");
+
+    for (const std::string& value : strings.table)
+        profile.bytes(6, value);
+
+    profile.integer(10, totalTicks(data) * 1000);
+    profile.bytes(11, periodType);
+    profile.integer(12, data.frequency > 0 ? uint64_t(1e6 / data.frequency) : 0);
+
+    return profile.data;
+}
+
+// a sampled profile of the nodes under task, or of every node for task 0
+static void appendSpeedscopeProfile(
+    std::string& result, const ProfileData& data, const std::vector<uint32_t>& tasks, const std::string& name, uint32_t task)
+{
+    uint64_t total = 0;
+    for (size_t i = 1; i < data.nodes.size(); ++i)
+        if (task == 0 || tasks[i] == task)
+            total += data.nodes[i].ticks;
+
+    result += "{\"type\":\"sampled\",\"name\":";
+    appendJsonString(result, name);
+    appendFormat(result, ",\"unit\":\"microseconds\",\"startValue\":0,\"endValue\":%lld,", static_cast<long long>(total));
+
+    // speedscope stacks go from the outermost frame in
+    std::string weights;
+    std::vector<uint32_t> stack;
+    bool first = true;
+
+    result += "\"samples\":[";
+
+    for (size_t i = 1; i < data.nodes.size(); ++i)
+    {
+        const ProfileNode& node = data.nodes[i];
+
+        if (node.ticks == 0 || (task != 0 && tasks[i] != task))
+            continue;
+
+        stack.clear();
+        for (const ProfileNode* frame = &node; frame != &data.nodes[0]; frame = &data.nodes[frame->parent])
+            stack.push_back(frame->frame);
+
+        result += first ? "[" : ",[";
+        for (size_t j = stack.size(); j > 0; --j)
+            appendFormat(result, j == stack.size() ? "%u" : ",%u", stack[j - 1]);
+        result += "]";
+
+        appendFormat(weights, first ? "%lld" : ",%lld", static_cast<long long>(node.ticks));
+        first = false;
+    }
+
+    result += "],\"weights\":[";
+    result += weights;
+    result += "]}";
+}
+
+static std::string writeSpeedscope(const ProfileData& data)
+{
+    std::string result = "{\"$schema\":\"https://www.speedscope.app/file-format-schema.json\",\"shared\":{\"frames\":[";
+
+    for (size_t i = 0; i < data.frames.size(); ++i)
+    {
+        const ProfileFrame& frame = data.frames[i];
+
+        result += i ? ",{\"name\":" : "{\"name\":";
+        appendJsonString(result, frameName(frame));
+
+        if (frame.kind == ProfileFrameKind::Function)
+        {
+            result += ",\"file\":";
+            appendJsonString(result, frame.source);
+
+            if (frame.linedefined > 0)
+                appendFormat(result, ",\"line\":%d", frame.linedefined);
+        }
+
+        result += "}";
+    }
+
+    std::vector<uint32_t> tasks = taskNodes(data);
+
+    result += "]},\"profiles\":[";
+    appendSpeedscopeProfile(result, data, tasks, "all", 0);
+
+    for (size_t i = 1; i < data.nodes.size(); ++i)
+    {
+        if (data.nodes[i].parent != 0)
+            continue;
+
+        result += ",";
+        appendSpeedscopeProfile(result, data, tasks, profileFrameLabel(data.frames[data.nodes[i].frame]), uint32_t(i));
+    }
+
+    result += "]}\n";
+    return result;
+}
+
+struct ProfileBox
+{
+    uint32_t node = 0;
+    uint64_t start = 0; // ticks from the left edge
+    uint64_t width = 0; // ticks of the node and everything it called
+    int depth = 0;      // 1 for the outermost frames
+};
+
+// flame graph layout: siblings side by side in name order, so the same frames line up across runs
+static std::vector<ProfileBox> layoutFlame(const ProfileData& data, int& maxDepth)
+{
+    size_t count = data.nodes.size();
+
+    std::vector<uint64_t> total(count);
+    for (size_t i = count; i-- > 0;)
+    {
+        total[i] += data.nodes[i].ticks;
+        if (i != 0)
+            total[data.nodes[i].parent] += total[i];
+    }
+
+    std::vector<std::string> labels;
+    labels.reserve(data.frames.size());
+    for (const ProfileFrame& frame : data.frames)
+        labels.push_back(profileFrameLabel(frame));
+
+    std::vector<std::vector<uint32_t>> children(count);
+    for (size_t i = 1; i < count; ++i)
+        if (total[i])
+            children[data.nodes[i].parent].push_back(uint32_t(i));
+
+    std::vector<ProfileBox> boxes;
+    std::vector<ProfileBox> pending = {{0, 0, total[0], 0}};
+
+    maxDepth = 0;
+
+    while (!pending.empty())
+    {
+        ProfileBox box = pending.back();
+        pending.pop_back();
+
+        if (box.node != 0)
+            boxes.push_back(box);
+
+        std::vector<uint32_t>& list = children[box.node];
+        std::sort(list.begin(), list.end(), [&](uint32_t a, uint32_t b) {
+            return labels[data.nodes[a].frame] < labels[data.nodes[b].frame];
+        });
+
+        uint64_t start = box.start;
+
+        for (uint32_t child : list)
+        {
+            pending.push_back({child, start, total[child], box.depth + 1});
+            start += total[child];
+        }
+
+        maxDepth = std::max(maxDepth, box.depth);
+    }
+
+    return boxes;
+}
+
+static std::string writeSvg(const ProfileData& data)
+{
+    const double kWidth = 1200;
+    const double kPadding = 10;
+    const double kHeader = 30;
+    const double kRow = 16;
+    const double kCharWidth = 6.6;
+
+    int maxDepth = 0;
+    std::vector<ProfileBox> boxes = layoutFlame(data, maxDepth);
+
+    uint64_t total = totalTicks(data);
+    double scale = total ? (kWidth - 2 * kPadding) / double(total) : 0;
+    double height = kHeader + maxDepth * kRow + kPadding;
+
+    std::string result;
+
+    appendFormat(result, "<?xml version=\"1.0\" standalone=\"no\"?>\n");
+    appendFormat(result, "<svg version=\"1.1\" width=\"%.0f\" height=\"%.0f\" viewBox=\"0 0 %.0f %.0f\" xmlns=\"http://www.w3.org/2000/svg\">\n",
+        kWidth, height, kWidth, height);
+    appendFormat(result, "<style>text { font-family: monospace; font-size: 11px; pointer-events: none; } rect:hover { stroke: #000; }</style>\n");
+    appendFormat(result, "<rect width=\"100%%\" height=\"100%%\" fill=\"#f8f8f8\"/>\n");
+    appendFormat(result, "<text x=\"%.0f\" y=\"20\" text-anchor=\"middle\" style=\"font-size: 14px\">luam profile, %.3f s</text>\n", kWidth / 2,
+        double(total) / 1e6);
+
+    for (const ProfileBox& box : boxes)
+    {
+        double width = double(box.width) * scale;
+        if (width < 0.1)
+            continue;
+
+        const ProfileFrame& frame = data.frames[data.nodes[box.node].frame];
+        std::string label = profileFrameLabel(frame);
+
+        double x = kPadding + double(box.start) * scale;
+        double y = height - kPadding - box.depth * kRow;
+
+        // warm colors for code, cold ones for the collector; the hash keeps a frame's color stable
+        size_t hash = std::hash<std::string>()(label);
+        int red = 205 + int(hash % 50), green = int((hash >> 8) % 180), blue = int((hash >> 16) % 55);
+
+        if (frame.kind != ProfileFrameKind::Function)
+            red = 80 + int(hash % 40), green = 130 + int((hash >> 8) % 40), blue = 220;
+
+        result += "<g><title>";
+        appendXmlString(result, label);
+        appendFormat(result, " (%.3f ms, %.2f%%)</title>", double(box.width) / 1e3, double(box.width) * 100.0 / double(total));
+        appendFormat(result, "<rect x=\"%.2f\" y=\"%.0f\" width=\"%.2f\" height=\"%.0f\" fill=\"rgb(%d,%d,%d)\"/>", x, y, width, kRow - 1, red, green,
+            blue);
+
+        size_t fits = size_t(std::max((width - 6) / kCharWidth, 0.0));
+
+        if (fits >= 3)
+        {
+            appendFormat(result, "<text x=\"%.2f\" y=\"%.0f\">", x + 3, y + kRow - 4);
+            appendXmlString(result, label.size() <= fits ? label : label.substr(0, fits - 2) + "..");
+            result += "</text>";
+        }
+
+        result += "</g>\n";
+    }
+
+    result += "</svg>\n";
+    return result;
+}
+
+static std::string writeChromeTrace(const ProfileData& data)
+{
+    int maxDepth = 0;
+    std::vector<ProfileBox> boxes = layoutFlame(data, maxDepth);
+
+    std::string result = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    result += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"luam\"}}";
+
+    // complete events nest by time, so the flame layout reads as a flame chart with the merged stacks on one timeline
+    for (const ProfileBox& box : boxes)
+    {
+        const ProfileFrame& frame = data.frames[data.nodes[box.node].frame];
+
+        result += ",\n{\"name\":";
+        appendJsonString(result, frameName(frame));
+        appendFormat(result, ",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%lld,\"dur\":%lld",
+            frame.kind == ProfileFrameKind::Function ? "lua" : "gc", static_cast<long long>(box.start), static_cast<long long>(box.width));
+
+        if (frame.kind == ProfileFrameKind::Function)
+        {
+            result += ",\"args\":{\"source\":";
+            appendJsonString(result, frame.source);
+            appendFormat(result, ",\"line\":%d}", frame.linedefined);
+        }
+
+        result += "}";
+    }
+
+    result += "\n]}\n";
+    return result;
+}
+
+std::string profileWrite(const ProfileData& data, ProfileFormat format)
+{
+    switch (format)
+    {
+    case ProfileFormat::Collapsed:
+        return writeCollapsed(data);
+    case ProfileFormat::Pprof:
+        return writePprof(data);
+    case ProfileFormat::Speedscope:
+        return writeSpeedscope(data);
+    case ProfileFormat::Svg:
+        return writeSvg(data);
+    case ProfileFormat::ChromeTrace:
+        return writeChromeTrace(data);
+    }
+
+    return std::string();
+}
@@ -0,0 +1,70 @@
+// ProfilerFormats.h : Writes the profiler's call stack trie as collapsed stacks, pprof, speedscope, an SVG flame graph
+// or a Chrome trace.
+//
+
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+enum class ProfileFrameKind
+{
+    Function,
+    GC,      // time spent in GC assists, the parent of the GC state frames
+    GCState, // the GC state the assist was in; synthetic, so collapsed stacks leave it out
+};
+
+struct ProfileFrame
+{
+    ProfileFrameKind kind = ProfileFrameKind::Function;
+    std::string source; // short_src
+    std::string name;
+    int linedefined = 0;
+};
+
+// call stack trie; node 0 is the root, every other node is a frame called from its parent's frame and comes after it
+struct ProfileNode
+{
+    uint32_t frame = 0;
+    uint32_t parent = 0;
+    uint64_t ticks = 0;   // microseconds of the samples that ended in this node
+    uint64_t samples = 0; // number of those samples
+};
+
+struct ProfileData
+{
+    std::vector<ProfileFrame> frames;
+    std::vector<ProfileNode> nodes = {ProfileNode()};
+    int frequency = 0;
+};
+
+// a task is whatever a coroutine started running with: the main chunk, a module, a delay/spawn callback; its samples
+// are those under its node on the trie's first level
+struct ProfileTask
+{
+    uint32_t frame = 0;
+    uint64_t ticks = 0;
+    uint64_t samples = 0;
+};
+
+// Tasks by time spent, most expensive first; tasks with no ticks are left out.
+std::vector<ProfileTask> profileTasks(const ProfileData& data);
+
+// "name (source:line)"
+std::string profileFrameLabel(const ProfileFrame& frame);
+
+enum class ProfileFormat
+{
+    Collapsed,   // "<ticks> <stack>" lines, innermost frame first
+    Pprof,       // uncompressed profile.proto, samples carry a "task" label
+    Speedscope,  // speedscope JSON, the merged profile followed by one per task
+    Svg,         // self-contained flame graph
+    ChromeTrace, // trace event JSON; the merged stacks laid out as a flame chart, not in time order
+};
+
+bool profileParseFormat(const char* name, ProfileFormat& format);
+const char* profileDefaultPath(ProfileFormat format);
+
+std::string profileWrite(const ProfileData& data, ProfileFormat format);
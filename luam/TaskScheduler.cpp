@@ -0,0 +1,1279 @@
+// TaskScheduler.cpp : Timer driven scheduling of sleeping threads (wait/delay).
+//
+
+#include "TaskScheduler.h"
+
+#include "Clock.h"
+#include "Output.h"
+
+#include "lua.h"
+#include "lualib.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+const uint32_t kNoRecord = ~0u;
+
+// everything the scheduler knows about a sleeping thread; records live in a slab pool and are addressed by index
+struct taskSleepRecord
+{
+    lua_State* thread = nullptr;
+    uint64_t startTime = 0;
+    uint64_t wakeUpTime = 0; // deadline, kept for the wake latency histogram
+    int ref = LUA_NOREF;
+    uint32_t generation = 0; // bumped on release so stale timer entries can be told apart from reused records
+    uint32_t nextFree = kNoRecord;
+    int nargs = 0; // arguments waiting on the thread's stack
+    bool sendTimeTaken = false;
+    bool timer = false; // sitting in the timer wheel rather than the deferred queue
+};
+
+// fixed size slabs are never moved or freed, so once the pool has grown to the peak number of sleeping threads a
+// wait/resume cycle doesn't touch the heap
+struct taskSleepPool
+{
+    static const uint32_t kSlabSize = 256;
+
+    std::vector<std::unique_ptr<taskSleepRecord[]>> slabs;
+    uint32_t freeList = kNoRecord;
+    uint32_t size = 0;
+
+    taskSleepRecord& operator[](uint32_t index)
+    {
+        return slabs[index / kSlabSize][index % kSlabSize];
+    }
+
+    uint32_t allocate()
+    {
+        if (freeList == kNoRecord)
+        {
+            if (size % kSlabSize == 0)
+                slabs.emplace_back(new taskSleepRecord[kSlabSize]);
+
+            return size++;
+        }
+
+        uint32_t index = freeList;
+        freeList = (*this)[index].nextFree;
+        return index;
+    }
+
+    void release(uint32_t index)
+    {
+        taskSleepRecord& record = (*this)[index];
+        record.thread = nullptr;
+        record.ref = LUA_NOREF;
+        record.generation++;
+        record.nextFree = freeList;
+        freeList = index;
+    }
+};
+
+// timer wheel entry; kept small since slots are plain vectors that get moved around when cascading
+struct taskTimer
+{
+    uint64_t wakeUpTime;
+    uint64_t sequence; // keeps timers with equal deadlines in FIFO order
+    uint32_t record;
+    uint32_t generation;
+
+    bool operator<(const taskTimer& other) const
+    {
+        return wakeUpTime != other.wakeUpTime ? wakeUpTime < other.wakeUpTime : sequence < other.sequence;
+    }
+};
+
+// Hierarchical timer wheel: 8 levels of 64 slots over ticks of 2^16 ns (~65us), which covers the whole 64-bit clock.
+// A timer goes into the level of the highest tick digit in which it differs from the current tick, so insertion is
+// O(1), and it moves down one or more levels whenever the wheel reaches its slot. Cancellation is lazy (see
+// taskSleepPool::release); stale entries are dropped when their slot is reached. Timers fire on the first tick
+// boundary at or after their deadline and are handed out in deadline order within a batch.
+struct taskTimerWheel
+{
+    static const int kTickShift = 16;
+    static const int kLevelBits = 6;
+    static const int kSlots = 1 << kLevelBits;
+    static const int kLevels = (64 - kTickShift + kLevelBits - 1) / kLevelBits;
+
+    std::vector<taskTimer> slots[kLevels][kSlots];
+    uint64_t occupied[kLevels] = {}; // bitmap of non-empty slots per level
+    std::vector<taskTimer> due;      // inserted at or behind the current tick
+    uint64_t currentTick = 0;
+    size_t size = 0; // entries including stale ones
+
+    static int digit(uint64_t tick, int level)
+    {
+        return int((tick >> (level * kLevelBits)) & (kSlots - 1));
+    }
+
+    static int highestBit(uint64_t value)
+    {
+        int bit = 0;
+        while (value >>= 1)
+            bit++;
+        return bit;
+    }
+
+    static int ctz(uint64_t value)
+    {
+        int bit = 0;
+        while (!(value & 1))
+        {
+            value >>= 1;
+            bit++;
+        }
+        return bit;
+    }
+
+    void insert(const taskTimer& timer)
+    {
+        // round up, so a timer never fires before its deadline
+        uint64_t tick = (timer.wakeUpTime >> kTickShift) + ((timer.wakeUpTime & ((uint64_t(1) << kTickShift) - 1)) != 0);
+
+        size++;
+
+        if (tick <= currentTick)
+        {
+            due.push_back(timer);
+            return;
+        }
+
+        int level = highestBit(tick ^ currentTick) / kLevelBits;
+        int slot = digit(tick, level);
+
+        slots[level][slot].push_back(timer);
+        occupied[level] |= uint64_t(1) << slot;
+    }
+
+    // first tick at which a slot has to be expired or cascaded, UINT64_MAX when nothing is left
+    uint64_t nextTick() const
+    {
+        uint64_t next = UINT64_MAX;
+
+        for (int level = 0; level < kLevels; ++level)
+        {
+            int current = digit(currentTick, level);
+            uint64_t mask = current == kSlots - 1 ? 0 : occupied[level] & (~uint64_t(0) << (current + 1));
+
+            if (!mask)
+                continue;
+
+            int shift = level * kLevelBits;
+            uint64_t block = shift + kLevelBits < 64 ? currentTick >> (shift + kLevelBits) << (shift + kLevelBits) : 0;
+            uint64_t tick = block | (uint64_t(ctz(mask)) << shift);
+
+            next = std::min(next, tick);
+        }
+
+        return next;
+    }
+
+    // clockNanoseconds() value at which expire has something to do
+    uint64_t nextExpiry() const
+    {
+        if (!due.empty())
+            return 0;
+
+        uint64_t tick = nextTick();
+        return tick > (UINT64_MAX >> kTickShift) ? UINT64_MAX : tick << kTickShift;
+    }
+
+    // appends the timers that are due at time now to out, in deadline order; live filters out cancelled entries
+    template<typename Live>
+    void expire(uint64_t now, std::vector<taskTimer>& out, Live live)
+    {
+        size_t first = out.size();
+        uint64_t nowTick = now >> kTickShift;
+
+        for (uint64_t tick = nextTick(); tick <= nowTick; tick = nextTick())
+        {
+            currentTick = tick;
+
+            // higher levels cascade first; entries that are due at this very tick end up in due
+            for (int level = kLevels - 1; level >= 0; --level)
+            {
+                int slot = digit(tick, level);
+
+                if (!(occupied[level] & (uint64_t(1) << slot)))
+                    continue;
+
+                std::vector<taskTimer> entries;
+                entries.swap(slots[level][slot]);
+                occupied[level] &= ~(uint64_t(1) << slot);
+                size -= entries.size();
+
+                for (const taskTimer& timer : entries)
+                {
+                    if (!live(timer))
+                        continue;
+
+                    if (level == 0)
+                    {
+                        out.push_back(timer);
+                        continue;
+                    }
+
+                    insert(timer);
+                }
+
+                // hand the buffer back so the slot doesn't allocate again next time round
+                if (slots[level][slot].empty())
+                {
+                    entries.clear();
+                    slots[level][slot].swap(entries);
+                }
+            }
+        }
+
+        // the wheel never holds ticks behind the current one, so it can simply catch up
+        currentTick = std::max(currentTick, nowTick);
+
+        for (const taskTimer& timer : due)
+            if (live(timer))
+                out.push_back(timer);
+
+        size -= due.size();
+        due.clear();
+
+        std::sort(out.begin() + first, out.end());
+    }
+
+    void clear()
+    {
+        for (int level = 0; level < kLevels; ++level)
+        {
+            for (int slot = 0; slot < kSlots; ++slot)
+                slots[level][slot].clear();
+
+            occupied[level] = 0;
+        }
+
+        due.clear();
+        size = 0;
+    }
+};
+
+// deferred queue and ready list entry, see taskTimer
+struct taskDeferred
+{
+    uint32_t record;
+    uint32_t generation;
+};
+
+// RunService event handler, pinned in the registry
+struct taskConnection
+{
+    int id;
+    int ref;
+};
+
+// thread followed by taskSchedulerTrack, pinned in the registry
+struct taskTracked
+{
+    lua_State* thread;
+    int ref;
+};
+
+// per lua_State scheduler data, reachable through lua_callbacks(L)->userdata
+struct TaskSchedulerState
+{
+    lua_State* L = nullptr;
+    uint64_t startTime = 0;
+
+    // guards timers, deferred and records; threads are only ever resumed by whoever owns the VM (the event loop or the
+    // background thread)
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    taskTimerWheel timers;
+    std::vector<taskTimer> expired;
+    uint64_t sleeping = 0; // live timers; the wheel also holds cancelled ones until their slot comes up
+    taskSleepPool records;
+    uint64_t sequence = 0;
+
+    // task.defer FIFO; drained as one batch at the end of every step without going through the timer wheel
+    std::vector<taskDeferred> deferred;
+    std::vector<taskDeferred> deferredBatch;
+
+    // records that are due, drained by taskSchedulerStep on the thread that owns the VM; with a frame budget, whatever
+    // didn't fit into a frame stays here (from readyHead on) for the next one. A record stays linked to its thread until
+    // it's resumed, so cancelling or rescheduling a ready thread turns its entry stale like any other queue entry
+    std::vector<taskDeferred> ready;
+    size_t readyHead = 0;
+    bool stepping = false; // set while ready is being drained, a blocking wait inside a resumed thread can't step
+
+    // frame loop (RunService), only touched by the thread that owns the VM; a zero period disables it
+    uint64_t framePeriod = 0;
+    uint64_t frameBudget = 0;
+    std::vector<taskConnection> connections[TaskFrameEventCount];
+    int nextConnection = 1;
+    bool firing = false;
+
+    // tracked threads that haven't finished yet, only touched by the thread that owns the VM
+    std::vector<taskTracked> tracked;
+    int failures = 0;
+
+    // external event source the loop calls back into at least every pollInterval and that keeps the loop alive
+    void (*poll)(lua_State* L) = nullptr;
+    uint64_t pollInterval = 0;
+    uint64_t nextPoll = 0;
+
+    // background mode: the scheduler thread steps this state while holding the VM lock
+    bool background = false;
+    std::mutex vm;
+
+    // queue depths are derived from the pool and the deferred queue when the stats are taken
+    TaskSchedulerStats stats;
+};
+
+struct TaskScheduler
+{
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    std::thread thread;
+    bool running = false;
+
+    // deadline the scheduler thread is currently sleeping until; enqueuing an earlier timer wakes it up
+    uint64_t nextWakeUpTime = UINT64_MAX;
+
+    // state currently being stepped by the scheduler thread, taskSchedulerDetach waits for it to finish
+    TaskSchedulerState* stepping = nullptr;
+    std::condition_variable steppingDone;
+
+    std::vector<TaskSchedulerState*> states;
+
+    bool dumpStats = false;
+} gTaskScheduler;
+
+void TaskSchedulerHistogram::record(uint64_t value)
+{
+    int bucket = 0;
+    for (uint64_t v = value; v && bucket < kBuckets - 1; v >>= 1)
+        bucket++;
+
+    buckets[bucket]++;
+    count++;
+    total += value;
+    max = std::max(max, value);
+}
+
+uint64_t TaskSchedulerHistogram::percentile(double fraction) const
+{
+    uint64_t target = uint64_t(double(count) * fraction);
+    uint64_t seen = 0;
+
+    for (int i = 0; i < kBuckets; ++i)
+    {
+        seen += buckets[i];
+
+        if (seen > target || seen == count)
+            return std::min(i == 0 ? 0 : uint64_t(1) << i, max);
+    }
+
+    return max;
+}
+
+static TaskSchedulerState* getState(lua_State* L)
+{
+    return static_cast<TaskSchedulerState*>(lua_callbacks(L)->userdata);
+}
+
+// once every timer has been cancelled the wheel only holds stale entries, which would keep the event loop waking up
+static void skipStaleTimers(TaskSchedulerState* ts)
+{
+    if (ts->sleeping == 0 && ts->timers.size != 0)
+        ts->timers.clear();
+}
+
+static bool isLive(TaskSchedulerState* ts, const taskTimer& timer)
+{
+    return ts->records[timer.record].generation == timer.generation;
+}
+
+void taskSchedulerAttach(lua_State* L)
+{
+    TaskSchedulerState* ts = new TaskSchedulerState();
+    ts->L = lua_mainthread(L);
+    ts->startTime = clockNanoseconds();
+    ts->timers.currentTick = ts->startTime >> taskTimerWheel::kTickShift;
+
+    lua_callbacks(L)->userdata = ts;
+
+    std::unique_lock<std::mutex> lock(gTaskScheduler.mutex);
+    gTaskScheduler.states.push_back(ts);
+}
+
+void taskSchedulerDetach(lua_State* L)
+{
+    TaskSchedulerState* ts = getState(L);
+    if (!ts)
+        return;
+
+    {
+        std::unique_lock<std::mutex> lock(gTaskScheduler.mutex);
+        auto& states = gTaskScheduler.states;
+        states.erase(std::remove(states.begin(), states.end(), ts), states.end());
+
+        while (gTaskScheduler.stepping == ts)
+            gTaskScheduler.steppingDone.wait(lock);
+    }
+
+    // the scheduler thread is done with the state, so its counters are stable now
+    if (gTaskScheduler.dumpStats)
+        taskSchedulerDumpStats(L);
+
+    lua_callbacks(L)->userdata = nullptr;
+    delete ts;
+}
+
+static void notifyBackground(uint64_t wakeUpTime)
+{
+    std::unique_lock<std::mutex> lock(gTaskScheduler.mutex);
+
+    if (wakeUpTime < gTaskScheduler.nextWakeUpTime)
+        gTaskScheduler.wakeUp.notify_one();
+}
+
+// scheduled threads point back at their record through the thread data slot (record index + 1, null otherwise)
+static uint32_t allocateRecordLocked(TaskSchedulerState* ts, lua_State* thread, int ref, int nargs, bool sendTimeTaken)
+{
+    uint32_t index = ts->records.allocate();
+
+    taskSleepRecord& record = ts->records[index];
+    record.thread = thread;
+    record.startTime = clockNanoseconds();
+    record.ref = ref;
+    record.nargs = nargs;
+    record.sendTimeTaken = sendTimeTaken;
+    record.timer = false;
+
+    lua_setthreaddata(thread, reinterpret_cast<void*>(uintptr_t(index) + 1));
+
+    return index;
+}
+
+static bool unscheduleLocked(TaskSchedulerState* ts, lua_State* thread)
+{
+    uintptr_t link = reinterpret_cast<uintptr_t>(lua_getthreaddata(thread));
+    if (!link)
+        return false;
+
+    uint32_t index = uint32_t(link - 1);
+    lua_setthreaddata(thread, nullptr);
+
+    if (index >= ts->records.size || ts->records[index].thread != thread)
+        return false;
+
+    // the timer wheel or deferred queue entry becomes stale and is skipped
+    if (ts->records[index].timer)
+        ts->sleeping--;
+
+    lua_unref(ts->L, ts->records[index].ref);
+    ts->records.release(index);
+    return true;
+}
+
+void taskSchedulerSleep(lua_State* L, double seconds, bool sendTimeTaken, int nargs)
+{
+    TaskSchedulerState* ts = getState(L);
+
+    lua_State* thread = lua_tothread(L, -1);
+    int ref = lua_ref(L, -1); // keep the thread alive while it sleeps
+    lua_pop(L, 1);
+
+    uint64_t wakeUpTime = 0;
+    bool background = false;
+
+    {
+        std::unique_lock<std::mutex> lock(ts->mutex);
+
+        // a thread is only ever scheduled once, rescheduling it replaces the previous timer
+        unscheduleLocked(ts, thread);
+
+        uint32_t index = allocateRecordLocked(ts, thread, ref, nargs, sendTimeTaken);
+        taskSleepRecord& record = ts->records[index];
+
+        uint64_t duration = clockFromSeconds(seconds);
+        wakeUpTime = duration > UINT64_MAX - record.startTime ? UINT64_MAX : record.startTime + duration;
+        record.wakeUpTime = wakeUpTime;
+        record.timer = true;
+
+        ts->sleeping++;
+        ts->stats.scheduled++;
+        ts->stats.peakSleeping = std::max(ts->stats.peakSleeping, ts->sleeping);
+
+        ts->timers.insert({wakeUpTime, ts->sequence++, index, record.generation});
+        background = ts->background;
+
+        ts->wakeUp.notify_one();
+    }
+
+    if (background)
+        notifyBackground(wakeUpTime);
+}
+
+void taskSchedulerDefer(lua_State* L, int nargs)
+{
+    TaskSchedulerState* ts = getState(L);
+
+    lua_State* thread = lua_tothread(L, -1);
+    int ref = lua_ref(L, -1);
+    lua_pop(L, 1);
+
+    bool background = false;
+
+    {
+        std::unique_lock<std::mutex> lock(ts->mutex);
+
+        unscheduleLocked(ts, thread);
+
+        uint32_t index = allocateRecordLocked(ts, thread, ref, nargs, false);
+        ts->records[index].wakeUpTime = ts->records[index].startTime;
+        ts->stats.scheduled++;
+
+        ts->deferred.push_back({index, ts->records[index].generation});
+        background = ts->background;
+
+        ts->wakeUp.notify_one();
+    }
+
+    if (background)
+        notifyBackground(0);
+}
+
+bool taskSchedulerCancel(lua_State* L, lua_State* thread)
+{
+    TaskSchedulerState* ts = getState(L);
+
+    std::unique_lock<std::mutex> lock(ts->mutex);
+
+    if (!unscheduleLocked(ts, thread))
+        return false;
+
+    ts->stats.cancelled++;
+    return true;
+}
+
+bool taskSchedulerIsScheduled(lua_State* thread)
+{
+    return lua_getthreaddata(thread) != nullptr;
+}
+
+int taskSchedulerResume(lua_State* co, lua_State* from, int nargs)
+{
+    int status = lua_resume(co, from, nargs);
+
+    if (status != LUA_OK && status != LUA_YIELD)
+    {
+        std::string error;
+
+        if (const char* str = lua_tostring(co, -1))
+            error = str;
+
+        error += "\nstacktrace:\n";
+        error += lua_debugtrace(co);
+        error += "\n";
+
+        writeError(error);
+    }
+
+    return status;
+}
+
+// a tracked thread is done unless it's waiting again; forgets it and counts it when it didn't finish cleanly
+static void finishTracked(TaskSchedulerState* ts, lua_State* co, int status)
+{
+    if (status == LUA_YIELD && taskSchedulerIsScheduled(co))
+        return;
+
+    auto it = std::find_if(ts->tracked.begin(), ts->tracked.end(), [co](const taskTracked& tracked) {
+        return tracked.thread == co;
+    });
+
+    if (it == ts->tracked.end())
+        return;
+
+    if (status == LUA_YIELD)
+        writeError("thread yielded unexpectedly\nstacktrace:\n" + std::string(lua_debugtrace(co)) + "\n");
+
+    if (status != LUA_OK)
+        ts->failures++;
+
+    lua_unref(ts->L, it->ref);
+    ts->tracked.erase(it);
+}
+
+static void resumeThread(TaskSchedulerState* ts, const taskSleepRecord& record)
+{
+    lua_State* co = record.thread;
+    int nargs = record.nargs;
+
+    uint64_t now = clockNanoseconds();
+    ts->stats.wakeLatency.record(now > record.wakeUpTime ? now - record.wakeUpTime : 0);
+
+    if (record.sendTimeTaken)
+    {
+        lua_pushnumber(co, clockToSeconds(now - record.startTime));
+        nargs++;
+    }
+
+    int status = taskSchedulerResume(co, NULL, nargs);
+
+    ts->stats.resumeTime.record(clockNanoseconds() - now);
+    ts->stats.resumed++;
+
+    if (status != LUA_OK && status != LUA_YIELD)
+        ts->stats.errors++;
+
+    if (!ts->tracked.empty())
+        finishTracked(ts, co, status);
+
+    lua_unref(ts->L, record.ref);
+}
+
+// moves a live record into the ready list; ts->mutex must be held
+static void readyLocked(TaskSchedulerState* ts, uint32_t index)
+{
+    taskSleepRecord& record = ts->records[index];
+
+    if (record.timer)
+        ts->sleeping--;
+
+    record.timer = false;
+    ts->ready.push_back({index, record.generation});
+}
+
+// resumes ready threads until the budget runs out (at least one per call, so a tiny budget still makes progress); the
+// rest stays queued in order and goes first on the next step
+static void drainReady(TaskSchedulerState* ts, uint64_t budgetEnd)
+{
+    ts->stepping = true;
+
+    for (size_t resumed = 0;;)
+    {
+        if (resumed > 0 && clockNanoseconds() >= budgetEnd)
+            break;
+
+        taskSleepRecord record;
+
+        {
+            std::unique_lock<std::mutex> lock(ts->mutex);
+
+            // indexed, since taskSchedulerClear may empty the list from an interrupt while a thread runs
+            if (ts->readyHead >= ts->ready.size())
+                break;
+
+            taskDeferred entry = ts->ready[ts->readyHead++];
+
+            // cancelled or rescheduled since it became ready
+            if (ts->records[entry.record].generation != entry.generation)
+                continue;
+
+            // the record is released before the thread runs, so the thread can schedule itself again; its ref moves
+            // along with the copy and resumeThread drops it
+            record = ts->records[entry.record];
+            lua_setthreaddata(record.thread, nullptr);
+            ts->records.release(entry.record);
+        }
+
+        resumeThread(ts, record);
+        resumed++;
+    }
+
+    std::unique_lock<std::mutex> lock(ts->mutex);
+
+    if (ts->readyHead < ts->ready.size())
+    {
+        ts->stats.carried += ts->ready.size() - ts->readyHead;
+        ts->ready.erase(ts->ready.begin(), ts->ready.begin() + ts->readyHead);
+    }
+    else
+    {
+        ts->ready.clear();
+    }
+
+    ts->readyHead = 0;
+    ts->stepping = false;
+}
+
+static bool stepState(TaskSchedulerState* ts, uint64_t budgetEnd)
+{
+    {
+        std::unique_lock<std::mutex> lock(ts->mutex);
+        uint64_t now = clockNanoseconds();
+
+        ts->timers.expire(now, ts->expired, [ts](const taskTimer& timer) {
+            return isLive(ts, timer);
+        });
+
+        for (const taskTimer& timer : ts->expired)
+            readyLocked(ts, timer.record);
+
+        ts->expired.clear();
+        skipStaleTimers(ts);
+
+        // threads deferred while this batch runs go into the next one
+        std::swap(ts->deferred, ts->deferredBatch);
+
+        for (const taskDeferred& entry : ts->deferredBatch)
+            if (ts->records[entry.record].generation == entry.generation)
+                readyLocked(ts, entry.record);
+
+        ts->deferredBatch.clear();
+        ts->stats.steps++;
+    }
+
+    drainReady(ts, budgetEnd);
+
+    std::unique_lock<std::mutex> lock(ts->mutex);
+    skipStaleTimers(ts);
+    return ts->sleeping != 0 || !ts->deferred.empty() || !ts->ready.empty();
+}
+
+bool taskSchedulerStep(lua_State* L)
+{
+    return stepState(getState(L), UINT64_MAX);
+}
+
+// resumes every connection of the event in a thread of its own so handlers can wait
+static void fireFrameEvent(TaskSchedulerState* ts, TaskFrameEvent event, int nargs, double arg0, double arg1)
+{
+    std::vector<taskConnection>& connections = ts->connections[event];
+    size_t count = connections.size(); // handlers connected while firing run from the next frame on
+
+    ts->firing = true;
+
+    for (size_t i = 0; i < count && i < connections.size(); ++i)
+    {
+        if (connections[i].ref == LUA_NOREF)
+            continue;
+
+        lua_State* co = lua_newthread(ts->L);
+        lua_getref(co, connections[i].ref);
+        lua_pushnumber(co, arg0);
+        if (nargs > 1)
+            lua_pushnumber(co, arg1);
+
+        taskSchedulerResume(co, NULL, nargs);
+        lua_pop(ts->L, 1);
+    }
+
+    ts->firing = false;
+
+    // drop connections that were disconnected while firing
+    connections.erase(std::remove_if(connections.begin(), connections.end(),
+                          [](const taskConnection& connection) {
+                              return connection.ref == LUA_NOREF;
+                          }),
+        connections.end());
+}
+
+static void runPoll(TaskSchedulerState* ts)
+{
+    uint64_t now = clockNanoseconds();
+
+    if (!ts->poll || now < ts->nextPoll)
+        return;
+
+    ts->nextPoll = now + ts->pollInterval;
+    ts->poll(ts->L);
+}
+
+static bool hasWork(TaskSchedulerState* ts)
+{
+    if (ts->poll)
+        return true;
+
+    for (const std::vector<taskConnection>& connections : ts->connections)
+        if (!connections.empty())
+            return true;
+
+    std::unique_lock<std::mutex> lock(ts->mutex);
+    skipStaleTimers(ts);
+    return ts->sleeping != 0 || !ts->deferred.empty() || !ts->ready.empty();
+}
+
+// RunService style frame loop: Stepped, then due threads within the frame budget, then Heartbeat, once per period;
+// returns once the frame rate is switched off or nothing is scheduled or connected anymore
+static void runFrames(TaskSchedulerState* ts)
+{
+    uint64_t lastFrame = clockNanoseconds();
+    uint64_t nextFrame = lastFrame;
+
+    while (ts->framePeriod && hasWork(ts))
+    {
+        std::this_thread::sleep_until(clockToTimePoint(nextFrame));
+
+        uint64_t frameStart = clockNanoseconds();
+        double deltaTime = clockToSeconds(frameStart - lastFrame);
+        lastFrame = frameStart;
+
+        fireFrameEvent(ts, TaskFrameStepped, 2, clockToSeconds(frameStart - ts->startTime), deltaTime);
+        stepState(ts, frameStart + ts->frameBudget);
+        fireFrameEvent(ts, TaskFrameHeartbeat, 1, deltaTime, 0);
+        runPoll(ts);
+
+        uint64_t frameEnd = clockNanoseconds();
+        uint64_t frameTime = frameEnd - frameStart;
+
+        ts->stats.frames++;
+        ts->stats.frameTime.record(frameTime);
+
+        if (frameTime > ts->framePeriod)
+            ts->stats.overruns++;
+
+        // a frame that ran long pushes the schedule back instead of bursting to catch up
+        nextFrame = std::max(nextFrame + ts->framePeriod, frameEnd);
+    }
+}
+
+void taskSchedulerRun(lua_State* L)
+{
+    TaskSchedulerState* ts = getState(L);
+
+    for (;;)
+    {
+        if (ts->framePeriod)
+        {
+            runFrames(ts);
+
+            if (ts->framePeriod)
+                return;
+        }
+
+        bool pending = taskSchedulerStep(L);
+        runPoll(ts);
+
+        if (!pending && !ts->poll)
+            return;
+
+        std::unique_lock<std::mutex> lock(ts->mutex);
+        skipStaleTimers(ts);
+
+        if (!ts->deferred.empty() || ts->framePeriod)
+            continue;
+
+        uint64_t next = ts->sleeping != 0 ? ts->timers.nextExpiry() : UINT64_MAX;
+        if (ts->poll)
+            next = std::min(next, ts->nextPoll);
+
+        if (next != UINT64_MAX)
+            ts->wakeUp.wait_until(lock, clockToTimePoint(next));
+    }
+}
+
+void taskSchedulerRunUntil(lua_State* L, uint64_t deadline)
+{
+    TaskSchedulerState* ts = getState(L);
+
+    // nested inside a step: ready is in use, so fall back to sleeping
+    if (ts->stepping)
+    {
+        std::this_thread::sleep_until(clockToTimePoint(deadline));
+        return;
+    }
+
+    while (clockNanoseconds() < deadline)
+    {
+        taskSchedulerStep(L);
+
+        std::unique_lock<std::mutex> lock(ts->mutex);
+        skipStaleTimers(ts);
+
+        if (!ts->deferred.empty())
+            continue;
+
+        uint64_t next = ts->sleeping == 0 ? deadline : std::min(deadline, ts->timers.nextExpiry());
+        ts->wakeUp.wait_until(lock, clockToTimePoint(next));
+    }
+}
+
+void taskSchedulerClear(lua_State* L)
+{
+    TaskSchedulerState* ts = getState(L);
+
+    for (std::vector<taskConnection>& connections : ts->connections)
+    {
+        for (const taskConnection& connection : connections)
+            if (connection.ref != LUA_NOREF)
+                lua_unref(ts->L, connection.ref);
+
+        connections.clear();
+    }
+
+    std::unique_lock<std::mutex> lock(ts->mutex);
+
+    // every live record is on a timer, deferred or ready, so walking the pool covers all three; the thread drainReady
+    // may be running right now was released before it was resumed, and drainReady drops its ref once it returns
+    for (uint32_t index = 0; index < ts->records.size; ++index)
+        if (ts->records[index].thread)
+            unscheduleLocked(ts, ts->records[index].thread);
+
+    ts->timers.clear();
+    ts->deferred.clear();
+
+    // an empty list ends a drainReady that is under way
+    ts->ready.clear();
+    ts->readyHead = 0;
+
+    lock.unlock();
+
+    // tracked threads were cut off before they could finish
+    for (const taskTracked& tracked : ts->tracked)
+        lua_unref(ts->L, tracked.ref);
+
+    ts->failures += int(ts->tracked.size());
+    ts->tracked.clear();
+}
+
+static bool hasEnvironment(lua_State* L, int ref, const void* globals)
+{
+    lua_getref(L, ref);
+    lua_getfenv(L, -1);
+    bool result = lua_topointer(L, -1) == globals;
+    lua_pop(L, 2);
+    return result;
+}
+
+void taskSchedulerCancelEnvironment(lua_State* L)
+{
+    TaskSchedulerState* ts = getState(L);
+    const void* globals = lua_topointer(L, -1);
+
+    for (std::vector<taskConnection>& connections : ts->connections)
+    {
+        for (size_t i = 0; i < connections.size();)
+        {
+            if (connections[i].ref == LUA_NOREF || !hasEnvironment(L, connections[i].ref, globals))
+            {
+                ++i;
+                continue;
+            }
+
+            lua_unref(ts->L, connections[i].ref);
+
+            // see taskSchedulerDisconnect
+            if (ts->firing)
+                connections[i++].ref = LUA_NOREF;
+            else
+                connections.erase(connections.begin() + i);
+        }
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(ts->mutex);
+
+        for (uint32_t index = 0; index < ts->records.size; ++index)
+        {
+            taskSleepRecord& record = ts->records[index];
+
+            if (record.thread && hasEnvironment(L, record.ref, globals))
+            {
+                unscheduleLocked(ts, record.thread);
+                ts->stats.cancelled++;
+            }
+        }
+    }
+
+    // a cancelled tracked thread never finishes, and isn't a failure either
+    for (size_t i = 0; i < ts->tracked.size();)
+    {
+        if (taskSchedulerIsScheduled(ts->tracked[i].thread) || !hasEnvironment(L, ts->tracked[i].ref, globals))
+        {
+            ++i;
+            continue;
+        }
+
+        lua_unref(ts->L, ts->tracked[i].ref);
+        ts->tracked.erase(ts->tracked.begin() + i);
+    }
+
+    lua_pop(L, 1);
+}
+
+void taskSchedulerTrack(lua_State* L)
+{
+    TaskSchedulerState* ts = getState(L);
+
+    lua_State* thread = lua_tothread(L, -1);
+    int ref = lua_ref(L, -1);
+    lua_pop(L, 1);
+
+    ts->tracked.push_back({thread, ref});
+}
+
+int taskSchedulerTakeFailures(lua_State* L)
+{
+    TaskSchedulerState* ts = getState(L);
+
+    // threads that were cancelled rather than finished are forgotten as well
+    for (size_t i = 0; i < ts->tracked.size();)
+    {
+        if (taskSchedulerIsScheduled(ts->tracked[i].thread))
+        {
+            ++i;
+            continue;
+        }
+
+        lua_unref(ts->L, ts->tracked[i].ref);
+        ts->tracked.erase(ts->tracked.begin() + i);
+    }
+
+    int failures = ts->failures;
+    ts->failures = 0;
+    return failures;
+}
+
+int taskSchedulerConnect(lua_State* L, TaskFrameEvent event)
+{
+    TaskSchedulerState* ts = getState(L);
+
+    int id = ts->nextConnection++;
+    ts->connections[event].push_back({id, lua_ref(L, -1)});
+    lua_pop(L, 1);
+
+    return id;
+}
+
+bool taskSchedulerDisconnect(lua_State* L, int id)
+{
+    TaskSchedulerState* ts = getState(L);
+
+    for (std::vector<taskConnection>& connections : ts->connections)
+    {
+        for (size_t i = 0; i < connections.size(); ++i)
+        {
+            if (connections[i].id != id || connections[i].ref == LUA_NOREF)
+                continue;
+
+            lua_unref(ts->L, connections[i].ref);
+
+            // fireFrameEvent is walking the list, it compacts it once it is done
+            if (ts->firing)
+                connections[i].ref = LUA_NOREF;
+            else
+                connections.erase(connections.begin() + i);
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void taskSchedulerSetFrameRate(lua_State* L, double rate, double budget)
+{
+    TaskSchedulerState* ts = getState(L);
+
+    ts->framePeriod = rate > 0 ? std::max(clockFromSeconds(1.0 / rate), uint64_t(1)) : 0;
+    ts->frameBudget = budget > 0 ? clockFromSeconds(budget) : ts->framePeriod;
+}
+
+void taskSchedulerSetPoll(lua_State* L, void (*poll)(lua_State* L), double interval)
+{
+    TaskSchedulerState* ts = getState(L);
+
+    ts->poll = poll;
+    ts->pollInterval = clockFromSeconds(interval);
+    ts->nextPoll = clockNanoseconds() + ts->pollInterval;
+}
+
+double taskSchedulerTime(lua_State* L)
+{
+    return clockToSeconds(clockNanoseconds() - getState(L)->startTime);
+}
+
+TaskSchedulerStats taskSchedulerGetStats(lua_State* L)
+{
+    TaskSchedulerState* ts = getState(L);
+
+    std::unique_lock<std::mutex> lock(ts->mutex);
+    skipStaleTimers(ts);
+
+    TaskSchedulerStats stats = ts->stats;
+    stats.frameRate = ts->framePeriod ? 1e9 / double(ts->framePeriod) : 0.0;
+    stats.frameBudget = clockToSeconds(ts->frameBudget);
+
+    uint64_t deferred = 0;
+    for (const taskDeferred& entry : ts->deferred)
+        if (ts->records[entry.record].generation == entry.generation)
+            deferred++;
+
+    stats.deferred = deferred;
+    stats.sleeping = ts->sleeping;
+    return stats;
+}
+
+void taskSchedulerResetStats(lua_State* L)
+{
+    TaskSchedulerState* ts = getState(L);
+
+    std::unique_lock<std::mutex> lock(ts->mutex);
+    ts->stats = TaskSchedulerStats();
+}
+
+static void formatHistogram(std::string& out, const char* name, const TaskSchedulerHistogram& histogram)
+{
+    char line[256];
+    double mean = histogram.count ? double(histogram.total) / double(histogram.count) : 0.0;
+
+    snprintf(line, sizeof(line), "  %-13s n=%llu mean=%.1fus p50=%.1fus p99=%.1fus max=%.1fus\n", name,
+        (unsigned long long)histogram.count, mean / 1e3, double(histogram.percentile(0.5)) / 1e3,
+        double(histogram.percentile(0.99)) / 1e3, double(histogram.max) / 1e3);
+    out += line;
+}
+
+void taskSchedulerDumpStats(lua_State* L)
+{
+    TaskSchedulerStats stats = taskSchedulerGetStats(L);
+
+    char line[256];
+    std::string out = "scheduler stats:\n";
+
+    snprintf(line, sizeof(line), "  sleeping=%llu deferred=%llu peak=%llu\n", (unsigned long long)stats.sleeping,
+        (unsigned long long)stats.deferred, (unsigned long long)stats.peakSleeping);
+    out += line;
+
+    snprintf(line, sizeof(line), "  scheduled=%llu cancelled=%llu resumed=%llu errors=%llu steps=%llu\n",
+        (unsigned long long)stats.scheduled, (unsigned long long)stats.cancelled, (unsigned long long)stats.resumed,
+        (unsigned long long)stats.errors, (unsigned long long)stats.steps);
+    out += line;
+
+    formatHistogram(out, "wake latency", stats.wakeLatency);
+    formatHistogram(out, "resume time", stats.resumeTime);
+
+    if (stats.frames)
+    {
+        snprintf(line, sizeof(line), "  frames=%llu overruns=%llu carried=%llu\n", (unsigned long long)stats.frames,
+            (unsigned long long)stats.overruns, (unsigned long long)stats.carried);
+        out += line;
+
+        formatHistogram(out, "frame time", stats.frameTime);
+    }
+
+    writeError(out);
+}
+
+void taskSchedulerSetDumpStats(bool enabled)
+{
+    gTaskScheduler.dumpStats = enabled;
+}
+
+void taskSchedulerSetBackground(lua_State* L, bool enabled)
+{
+    TaskSchedulerState* ts = getState(L);
+
+    {
+        std::unique_lock<std::mutex> lock(ts->mutex);
+        ts->background = enabled;
+    }
+
+    std::unique_lock<std::mutex> lock(gTaskScheduler.mutex);
+    gTaskScheduler.wakeUp.notify_one();
+}
+
+void taskSchedulerLock(lua_State* L)
+{
+    getState(L)->vm.lock();
+}
+
+void taskSchedulerUnlock(lua_State* L)
+{
+    getState(L)->vm.unlock();
+}
+
+static void taskSchedulerLoop()
+{
+    std::unique_lock<std::mutex> lock(gTaskScheduler.mutex);
+
+    while (gTaskScheduler.running)
+    {
+        uint64_t now = clockNanoseconds();
+        uint64_t next = UINT64_MAX;
+        TaskSchedulerState* due = nullptr;
+
+        for (TaskSchedulerState* ts : gTaskScheduler.states)
+        {
+            std::unique_lock<std::mutex> stateLock(ts->mutex);
+            skipStaleTimers(ts);
+
+            if (!ts->background || (ts->sleeping == 0 && ts->deferred.empty()))
+                continue;
+
+            uint64_t expiry = ts->timers.nextExpiry();
+
+            if (!ts->deferred.empty() || expiry <= now)
+            {
+                due = ts;
+                break;
+            }
+
+            next = std::min(next, expiry);
+        }
+
+        if (due)
+        {
+            // the owner of the VM may be running code, so the state is stepped under its VM lock; resumed threads
+            // may schedule new timers, so the scheduler lock can't be held while they run
+            gTaskScheduler.stepping = due;
+            lock.unlock();
+
+            {
+                std::unique_lock<std::mutex> vmLock(due->vm);
+                taskSchedulerStep(due->L);
+            }
+
+            lock.lock();
+            gTaskScheduler.stepping = nullptr;
+            gTaskScheduler.steppingDone.notify_all();
+            continue;
+        }
+
+        gTaskScheduler.nextWakeUpTime = next;
+
+        if (next == UINT64_MAX)
+            gTaskScheduler.wakeUp.wait(lock);
+        else
+            gTaskScheduler.wakeUp.wait_until(lock, clockToTimePoint(next));
+
+        gTaskScheduler.nextWakeUpTime = UINT64_MAX;
+    }
+}
+
+void startTaskScheduler()
+{
+    if (gTaskScheduler.running)
+        return;
+
+    // a previous scheduler thread may still be on its way out
+    if (gTaskScheduler.thread.joinable())
+        gTaskScheduler.thread.join();
+
+    gTaskScheduler.running = true;
+    gTaskScheduler.thread = std::thread(taskSchedulerLoop);
+}
+
+void stopTaskScheduler()
+{
+    {
+        std::unique_lock<std::mutex> lock(gTaskScheduler.mutex);
+        gTaskScheduler.running = false;
+        gTaskScheduler.wakeUp.notify_one();
+    }
+
+    // stopTaskScheduler can be reached from a thread the scheduler resumed, which can't join itself
+    if (gTaskScheduler.thread.joinable())
+    {
+        if (gTaskScheduler.thread.get_id() != std::this_thread::get_id())
+            gTaskScheduler.thread.join();
+        else
+            gTaskScheduler.thread.detach();
+    }
+}
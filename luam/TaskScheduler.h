@@ -0,0 +1,127 @@
+// TaskScheduler.h : Timer driven scheduling of sleeping threads (wait/delay).
+//
+
+#pragma once
+
+#include <stdint.h>
+
+struct lua_State;
+
+// log2 histogram of nanosecond durations; bucket i counts values in [2^(i-1), 2^i)
+struct TaskSchedulerHistogram
+{
+    static const int kBuckets = 48;
+
+    uint64_t buckets[kBuckets] = {};
+    uint64_t count = 0;
+    uint64_t total = 0;
+    uint64_t max = 0;
+
+    void record(uint64_t value);
+    // upper bound of the bucket that holds the given fraction (0..1) of the samples
+    uint64_t percentile(double fraction) const;
+};
+
+struct TaskSchedulerStats
+{
+    // queue depths at the time the stats were taken
+    uint64_t sleeping = 0;
+    uint64_t deferred = 0;
+    uint64_t peakSleeping = 0;
+
+    uint64_t scheduled = 0; // wait/delay/task.* calls that put a thread to sleep
+    uint64_t cancelled = 0;
+    uint64_t resumed = 0;
+    uint64_t errors = 0;
+    uint64_t steps = 0;
+
+    TaskSchedulerHistogram wakeLatency; // how late threads were resumed relative to their deadline
+    TaskSchedulerHistogram resumeTime;  // time spent inside lua_resume
+
+    // frame loop, see taskSchedulerSetFrameRate
+    double frameRate = 0;
+    double frameBudget = 0;
+    uint64_t frames = 0;
+    uint64_t overruns = 0; // frames that took longer than the frame period
+    uint64_t carried = 0;  // threads that didn't fit into their frame's budget and moved to the next one
+    TaskSchedulerHistogram frameTime;
+};
+
+enum TaskFrameEvent
+{
+    TaskFrameStepped,   // fired before due threads are resumed with (time, deltaTime)
+    TaskFrameHeartbeat, // fired after due threads are resumed with (deltaTime)
+
+    TaskFrameEventCount
+};
+
+void taskSchedulerAttach(lua_State* L);
+void taskSchedulerDetach(lua_State* L);
+
+// Schedules the thread on top of L's stack to be resumed after the given amount of seconds and pops it.
+// The thread is resumed with the nargs values on top of its own stack, followed by the elapsed time when
+// sendTimeTaken is set. Scheduling a thread that is already scheduled replaces its previous schedule.
+void taskSchedulerSleep(lua_State* L, double seconds, bool sendTimeTaken, int nargs = 0);
+// Like taskSchedulerSleep, but the thread is resumed in the deferred batch at the end of the next step.
+void taskSchedulerDefer(lua_State* L, int nargs);
+// Removes the thread from the timers/deferred queue; returns false if it wasn't scheduled.
+bool taskSchedulerCancel(lua_State* L, lua_State* thread);
+
+// True while the thread sits in the timers/deferred queue, i.e. a yield of it was a wait rather than a real yield.
+bool taskSchedulerIsScheduled(lua_State* thread);
+
+// Resumes co, reporting errors the same way scheduled threads do; returns the resume status.
+int taskSchedulerResume(lua_State* co, lua_State* from, int nargs);
+
+// Resumes every thread whose timer is due and then the deferred batch on the calling thread; returns true while
+// timers or deferred threads remain.
+bool taskSchedulerStep(lua_State* L);
+// Event loop: keeps stepping the state on the calling thread until nothing is scheduled anymore. With a frame rate set,
+// it runs frames instead until no thread is scheduled and no handler is connected.
+void taskSchedulerRun(lua_State* L);
+// Keeps stepping the state on the calling thread until the given clockNanoseconds() deadline; used by code that can't
+// yield (the main thread) so that other threads keep running while it waits.
+void taskSchedulerRunUntil(lua_State* L, uint64_t deadline);
+// Drops every pending timer and deferred thread of the state.
+void taskSchedulerClear(lua_State* L);
+// Cancels every scheduled thread and disconnects every frame handler whose globals are the table on top of L's stack,
+// and pops it. Threads and functions inherit the globals of the code that creates them, so for the globals of a
+// sandboxed chunk this stops everything the chunk started.
+void taskSchedulerCancelEnvironment(lua_State* L);
+
+// Follows the thread on top of L's stack, which is waiting in the scheduler, and pops it. Once the event loop resumes
+// it for the last time, ending in an error or in a yield that isn't a wait counts as a failure.
+void taskSchedulerTrack(lua_State* L);
+// Returns the number of tracked threads that failed since the last call.
+int taskSchedulerTakeFailures(lua_State* L);
+
+// Connects the function on top of L's stack to a frame event and pops it; returns the connection id.
+int taskSchedulerConnect(lua_State* L, TaskFrameEvent event);
+bool taskSchedulerDisconnect(lua_State* L, int id);
+// Runs the event loop as fixed rate frames (rate in Hz, 0 turns frames off); resuming due threads stops once a frame
+// has used up its budget (in seconds, defaults to the whole frame) and the remaining ones run first in the next frame.
+void taskSchedulerSetFrameRate(lua_State* L, double rate, double budget);
+
+// Makes the event loop call poll on the thread that runs it at least every interval seconds, in between steps/frames;
+// while a poll function is set the loop keeps running even when nothing is scheduled. Pass nullptr to remove it.
+void taskSchedulerSetPoll(lua_State* L, void (*poll)(lua_State* L), double interval);
+
+// Seconds since the state was attached, on the same clock as the timers.
+double taskSchedulerTime(lua_State* L);
+
+// Scheduler telemetry of the state; counters are kept by whoever owns the VM, so this is meant to be called from it.
+TaskSchedulerStats taskSchedulerGetStats(lua_State* L);
+void taskSchedulerResetStats(lua_State* L);
+// Writes a human readable summary to the error output.
+void taskSchedulerDumpStats(lua_State* L);
+// Dumps the stats of every state as it is detached (--scheduler-stats).
+void taskSchedulerSetDumpStats(bool enabled);
+
+// Background mode hands the state to the scheduler thread (used by the REPL, where the main thread blocks on input).
+// Code running on the state from any other thread has to hold the VM lock while the scheduler thread is active.
+void taskSchedulerSetBackground(lua_State* L, bool enabled);
+void taskSchedulerLock(lua_State* L);
+void taskSchedulerUnlock(lua_State* L);
+
+void startTaskScheduler();
+void stopTaskScheduler();
@@ -0,0 +1,84 @@
+// TextFormat.cpp : String building helpers shared by the report and profile writers.
+//
+
+#include "TextFormat.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+void appendFormat(std::string& result, const char* format, ...)
+{
+    char buffer[512];
+
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+
+    if (length < 0)
+        return;
+
+    if (size_t(length) < sizeof(buffer))
+    {
+        result.append(buffer, length);
+        return;
+    }
+
+    // didn't fit, format again straight into the result
+    size_t offset = result.size();
+    result.resize(offset + length + 1);
+
+    va_start(args, format);
+    vsnprintf(&result[offset], length + 1, format, args);
+    va_end(args);
+
+    result.resize(offset + length);
+}
+
+void appendJsonString(std::string& result, const std::string& value)
+{
+    result += '"';
+
+    for (unsigned char ch : value)
+    {
+        if (ch == '"' || ch == '\\')
+        {
+            result += '\\';
+            result += char(ch);
+        }
+        else if (ch < 0x20)
+        {
+            appendFormat(result, "\\u%04x", ch);
+        }
+        else
+        {
+            result += char(ch);
+        }
+    }
+
+    result += '"';
+}
+
+void appendXmlString(std::string& result, const std::string& value)
+{
+    for (char ch : value)
+    {
+        switch (ch)
+        {
+        case '&':
+            result += "&amp;";
+            break;
+        case '<':
+            result += "&lt;";
+            break;
+        case '>':
+            result += "&gt;";
+            break;
+        case '"':
+            result += "&quot;";
+            break;
+        default:
+            result += ch;
+        }
+    }
+}
@@ -0,0 +1,14 @@
+// TextFormat.h : String building helpers shared by the report and profile writers.
+//
+
+#pragma once
+
+#include <string>
+
+// printf into the end of result
+void appendFormat(std::string& result, const char* format, ...);
+
+// value as a quoted JSON string
+void appendJsonString(std::string& result, const std::string& value);
+// value escaped for XML text and attribute values
+void appendXmlString(std::string& result, const std::string& value);
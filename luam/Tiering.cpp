@@ -0,0 +1,180 @@
+// Tiering.cpp : Profile-guided native compilation; functions start in the interpreter and only the hot ones are compiled.
+//
+
+#include "Tiering.h"
+
+#include "lua.h"
+#include "lualib.h"
+
+#include "../luau/VM/src/lstate.h"
+
+#include "Luau/CodeGen.h"
+#include "Luau/DenseHash.h"
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// the interrupt fires at the next call or loop back edge, so a sample counts one of those for the running function
+// without making the interpreter pay for counting the rest
+static const std::chrono::milliseconds kTieringSampleInterval(1);
+
+// a sample that lands in a C function is charged to the closest Lua function below it, within this many frames
+static const int kTieringMaxLevels = 4;
+
+struct TieringState
+{
+    lua_Callbacks* callbacks = nullptr;
+
+    // samples per function prototype, so every closure of a function counts towards it; only touched by the thread
+    // running the VM
+    Luau::DenseHashMap<const Proto*, uint32_t> samples{nullptr};
+};
+
+struct Tiering
+{
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    std::thread thread;
+    bool running = false;
+
+    std::vector<TieringState*> states;
+
+    uint32_t threshold = 4;
+} gTiering;
+
+static TieringState* findState(lua_Callbacks* callbacks)
+{
+    std::unique_lock<std::mutex> lock(gTiering.mutex);
+
+    for (TieringState* state : gTiering.states)
+        if (state->callbacks == callbacks)
+            return state;
+
+    return nullptr;
+}
+
+static void tieringTrigger(lua_State* L, int gc)
+{
+    lua_Callbacks* callbacks = lua_callbacks(L);
+
+    // someone else (Ctrl-C, the profiler) may have claimed the interrupt since it was armed
+    if (callbacks->interrupt == tieringTrigger)
+        callbacks->interrupt = nullptr;
+
+    if (gc >= 0)
+        return;
+
+    TieringState* state = findState(callbacks);
+    if (!state)
+        return;
+
+    lua_rawcheckstack(L, 1);
+
+    lua_Debug ar;
+    for (int level = 0; level < kTieringMaxLevels && lua_getinfo(L, level, "sf", &ar); ++level)
+    {
+        if (ar.what[0] == 'C')
+        {
+            lua_pop(L, 1);
+            continue;
+        }
+
+        const Proto* proto = clvalue(L->top - 1)->l.p;
+
+        // whether it was compiled is read from the proto itself, so a proto allocated where a collected one used to be
+        // doesn't inherit that; it only inherits the count, which at worst compiles it a little early
+        if (!proto->execdata)
+        {
+            uint32_t& count = state->samples[proto];
+
+            // compiling the proto doesn't move the running frame into native code, the function runs natively from its
+            // next call; one that can't be compiled is retried after another threshold worth of samples. CodeGen only
+            // compiles a closure's proto together with the protos nested in it, so a hot function brings its inner
+            // functions along even if they are cold
+            if (++count >= gTiering.threshold)
+            {
+                Luau::CodeGen::compile(L, -1);
+                count = 0;
+            }
+        }
+
+        lua_pop(L, 1);
+        break;
+    }
+}
+
+static void tieringLoop()
+{
+    std::unique_lock<std::mutex> lock(gTiering.mutex);
+
+    while (gTiering.running)
+    {
+        gTiering.wakeUp.wait_for(lock, kTieringSampleInterval);
+
+        // an interrupt that's already set (Ctrl-C, the profiler) is left alone, the sample is simply skipped
+        for (TieringState* state : gTiering.states)
+            if (!state->callbacks->interrupt)
+                state->callbacks->interrupt = tieringTrigger;
+    }
+}
+
+void tieringSetThreshold(int samples)
+{
+    std::unique_lock<std::mutex> lock(gTiering.mutex);
+    gTiering.threshold = uint32_t(std::max(samples, 1));
+}
+
+void tieringAttach(lua_State* L)
+{
+    TieringState* state = new TieringState();
+    state->callbacks = lua_callbacks(L);
+
+    std::unique_lock<std::mutex> lock(gTiering.mutex);
+    gTiering.states.push_back(state);
+
+    if (!gTiering.running)
+    {
+        // the previous sampler thread was stopped by the last detach, which joined it
+        gTiering.running = true;
+        gTiering.thread = std::thread(tieringLoop);
+    }
+}
+
+void tieringDetach(lua_State* L)
+{
+    lua_Callbacks* callbacks = lua_callbacks(L);
+    std::thread thread;
+
+    {
+        std::unique_lock<std::mutex> lock(gTiering.mutex);
+
+        auto it = std::find_if(gTiering.states.begin(), gTiering.states.end(), [callbacks](TieringState* state) {
+            return state->callbacks == callbacks;
+        });
+
+        if (it == gTiering.states.end())
+            return;
+
+        delete *it;
+        gTiering.states.erase(it);
+
+        if (callbacks->interrupt == tieringTrigger)
+            callbacks->interrupt = nullptr;
+
+        if (gTiering.states.empty())
+        {
+            gTiering.running = false;
+            gTiering.wakeUp.notify_one();
+            thread = std::move(gTiering.thread);
+        }
+    }
+
+    if (thread.joinable())
+        thread.join();
+}
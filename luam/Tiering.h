@@ -0,0 +1,15 @@
+// Tiering.h : Profile-guided native compilation; functions start in the interpreter and only the hot ones are compiled.
+//
+
+#pragma once
+
+struct lua_State;
+
+// Number of samples (one per millisecond of execution) a function needs before it's compiled to native code.
+void tieringSetThreshold(int samples);
+
+// Starts sampling the state; while any state is attached, a sampler thread interrupts each of them once per
+// millisecond and charges the Lua function that is running.
+void tieringAttach(lua_State* L);
+// Stops sampling the state, does nothing if it isn't attached.
+void tieringDetach(lua_State* L);
@@ -0,0 +1,209 @@
+// Watch.cpp : Reports changes to the files a script loaded (--watch).
+//
+
+#include "Watch.h"
+
+#include "FileUtils.h"
+
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <stdint.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// whole seconds would miss a second save within the same second, and some file systems only keep coarse times, so the
+// size is compared as well
+struct WatchStamp
+{
+    int64_t mtime = -1; // nanoseconds, -1 while the file is missing
+    int64_t size = -1;
+
+    bool operator!=(const WatchStamp& other) const
+    {
+        return mtime != other.mtime || size != other.size;
+    }
+};
+
+struct WatchState
+{
+    std::mutex mutex;
+    bool active = false;
+
+#ifdef __linux__
+    // editors either rewrite a file in place or rename a new one over it, so the directories are watched rather than the
+    // files; a file is identified by its directory's watch descriptor and its name
+    int inotify = -1;
+    std::unordered_map<std::string, int> directories;
+    std::unordered_map<int, std::unordered_map<std::string, std::string>> files; // wd -> name -> path
+#endif
+
+    // modification times and sizes, used when inotify isn't available
+    std::unordered_map<std::string, WatchStamp> stamps;
+} gWatch;
+
+#ifdef _WIN32
+static std::wstring fromUtf8(const std::string& path)
+{
+    int length = MultiByteToWideChar(CP_UTF8, 0, path.data(), int(path.size()), nullptr, 0);
+
+    std::wstring result(length, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, path.data(), int(path.size()), &result[0], length);
+    return result;
+}
+#endif
+
+static WatchStamp getStamp(const std::string& path)
+{
+    WatchStamp stamp;
+
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA data = {};
+    if (!GetFileAttributesExW(fromUtf8(path).c_str(), GetFileExInfoStandard, &data))
+        return stamp;
+
+    // FILETIME counts 100ns intervals
+    stamp.mtime = int64_t((uint64_t(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime) * 100;
+    stamp.size = int64_t((uint64_t(data.nFileSizeHigh) << 32) | data.nFileSizeLow);
+#else
+    struct stat st = {};
+    if (stat(path.c_str(), &st) != 0)
+        return stamp;
+
+#ifdef __APPLE__
+    stamp.mtime = int64_t(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    stamp.mtime = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    stamp.size = int64_t(st.st_size);
+#endif
+
+    return stamp;
+}
+
+void watchStart()
+{
+    std::unique_lock<std::mutex> lock(gWatch.mutex);
+
+    if (gWatch.active)
+        return;
+
+    gWatch.active = true;
+
+#ifdef __linux__
+    gWatch.inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+}
+
+bool watchActive()
+{
+    std::unique_lock<std::mutex> lock(gWatch.mutex);
+    return gWatch.active;
+}
+
+void watchFile(const std::string& path)
+{
+    std::unique_lock<std::mutex> lock(gWatch.mutex);
+
+    if (!gWatch.active)
+        return;
+
+#ifdef __linux__
+    if (gWatch.inotify >= 0)
+    {
+        std::string directory = getParentPath(path).value_or(std::string());
+        std::string name = directory.empty() ? path : path.substr(directory.size() + (directory == "/" ? 0 : 1));
+
+        if (directory.empty())
+            directory = ".";
+
+        auto it = gWatch.directories.find(directory);
+
+        if (it == gWatch.directories.end())
+        {
+            int wd = inotify_add_watch(gWatch.inotify, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+            if (wd < 0)
+                return;
+
+            it = gWatch.directories.emplace(directory, wd).first;
+        }
+
+        gWatch.files[it->second].emplace(name, path);
+        return;
+    }
+#endif
+
+    gWatch.stamps.emplace(path, getStamp(path));
+}
+
+std::vector<std::string> watchPoll()
+{
+    std::unique_lock<std::mutex> lock(gWatch.mutex);
+
+    std::vector<std::string> changed;
+
+#ifdef __linux__
+    if (gWatch.inotify >= 0)
+    {
+        std::unordered_set<std::string> seen;
+        alignas(inotify_event) char buffer[16 * 1024];
+
+        for (;;)
+        {
+            ssize_t length = read(gWatch.inotify, buffer, sizeof(buffer));
+            if (length <= 0)
+                break;
+
+            for (ssize_t offset = 0; offset < length;)
+            {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+                offset += sizeof(inotify_event) + event->len;
+
+                if (event->len == 0)
+                    continue;
+
+                auto directory = gWatch.files.find(event->wd);
+                if (directory == gWatch.files.end())
+                    continue;
+
+                auto file = directory->second.find(event->name);
+                if (file != directory->second.end() && seen.insert(file->second).second)
+                    changed.push_back(file->second);
+            }
+        }
+
+        return changed;
+    }
+#endif
+
+    for (auto& [path, stamp] : gWatch.stamps)
+    {
+        WatchStamp current = getStamp(path);
+
+        if (current != stamp)
+        {
+            stamp = current;
+            changed.push_back(path);
+        }
+    }
+
+    std::sort(changed.begin(), changed.end());
+    return changed;
+}
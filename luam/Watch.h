@@ -0,0 +1,18 @@
+// Watch.h : Reports changes to the files a script loaded (--watch).
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Starts tracking changes; until then watchFile does nothing, so require can report every file unconditionally.
+void watchStart();
+bool watchActive();
+
+// Adds a file to the watched set; adding a file twice is harmless.
+void watchFile(const std::string& path);
+
+// Returns the watched files (as they were passed to watchFile) that were written since the last call, each once,
+// without blocking. Uses inotify on Linux and compares nanosecond modification times and sizes everywhere else.
+std::vector<std::string> watchPoll();
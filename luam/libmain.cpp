@@ -10,6 +10,7 @@
 #include "Luau/BytecodeBuilder.h"
 #include "Luau/Parser.h"
 
+#include "CompileStats.h"
 #include "Coverage.h"
 #include "FileUtils.h"
 #include "Flags.h"
@@ -40,7 +41,7 @@ static void sigintCallback(lua_State* L, int gc)
 
     lua_callbacks(L)->interrupt = NULL;
 
-    stopTaskScheduler();
+    taskSchedulerClear(L);
 
     lua_rawcheckstack(L, 1); // reserve space for error string
     luaL_error(L, "Execution interrupted");
@@ -156,22 +157,23 @@ static void annotateInstruction(void* context, std::string& text, int fid, int i
     bcb.annotateInstruction(text, fid, instpos);
 }
 
-struct CompileStats
-{
-    size_t lines;
-    size_t bytecode;
-    size_t codegen;
-};
-
 static bool compileFile(const char* name, CompileFormat format, CompileStats& stats)
 {
+    CompileFileStats& file = stats.files.emplace_back();
+    file.name = name;
+
+    uint64_t start = clockNanoseconds();
     std::optional<std::string> source = readFile(name);
+    file.readTime = clockToSeconds(clockNanoseconds() - start);
+
     if (!source)
     {
         fprintf(stderr, "Error opening %s\n", name);
         return false;
     }
 
+    file.sourceBytes = source->size();
+
     // NOTE: Normally, you should use Luau::compile or luau_compile (see lua_require as an example)
     // This function is much more complicated because it supports many output human-readable formats through internal interfaces
 
@@ -213,14 +215,21 @@ static bool compileFile(const char* name, CompileFormat format, CompileStats& st
 
         Luau::Allocator allocator;
         Luau::AstNameTable names(allocator);
+
+        start = clockNanoseconds();
         Luau::ParseResult result = Luau::Parser::parse(source->c_str(), source->size(), names, allocator);
+        file.parseTime = clockToSeconds(clockNanoseconds() - start);
 
         if (!result.errors.empty())
             throw Luau::ParseErrors(result.errors);
 
         stats.lines += result.lines;
+        file.lines = result.lines;
 
+        start = clockNanoseconds();
         Luau::compileOrThrow(bcb, result, names, copts());
+        file.compileTime = clockToSeconds(clockNanoseconds() - start);
+
         stats.bytecode += bcb.getBytecode().size();
 
         switch (format)
@@ -234,14 +243,28 @@ static bool compileFile(const char* name, CompileFormat format, CompileStats& st
         case CompileFormat::Binary:
             fwrite(bcb.getBytecode().data(), 1, bcb.getBytecode().size(), stdout);
             break;
+        case CompileFormat::Container:
+        {
+            std::string container = makeBytecodeContainer(bcb.getBytecode());
+            fwrite(container.data(), 1, container.size(), stdout);
+            break;
+        }
         case CompileFormat::Codegen:
         case CompileFormat::CodegenAsm:
         case CompileFormat::CodegenIr:
         case CompileFormat::CodegenVerbose:
-            printf("%s", getCodegenAssembly(name, bcb.getBytecode(), options).c_str());
+        {
+            start = clockNanoseconds();
+            std::string assembly = getCodegenAssembly(name, bcb.getBytecode(), options);
+            file.codegenTime = clockToSeconds(clockNanoseconds() - start);
+
+            printf("%s", assembly.c_str());
             break;
+        }
         case CompileFormat::CodegenNull:
+            start = clockNanoseconds();
             stats.codegen += getCodegenAssembly(name, bcb.getBytecode(), options).size();
+            file.codegenTime = clockToSeconds(clockNanoseconds() - start);
             break;
         case CompileFormat::Null:
             break;
@@ -264,14 +287,13 @@ static bool compileFile(const char* name, CompileFormat format, CompileStats& st
 
 extern "C" const char* executeScript(const char* source)
 {
-    startTaskScheduler();
     // setup flags
     for (Luau::FValue<bool>* flag = Luau::FValue<bool>::list; flag; flag = flag->next)
         if (strncmp(flag->name, "Luau", 4) == 0)
             flag->value = true;
 
     // create new state
-    std::unique_ptr<lua_State, void (*)(lua_State*)> globalState(luaL_newstate(), lua_close);
+    std::unique_ptr<lua_State, void (*)(lua_State*)> globalState(luaL_newstate(), closeState);
     lua_State* L = globalState.get();
 
     // setup state
@@ -286,5 +308,8 @@ extern "C" const char* executeScript(const char* source)
     // run code + collect error
     result = runCode(L, source);
 
+    // run pending wait/delay callbacks before the state goes away
+    taskSchedulerRun(L);
+
     return result.empty() ? NULL : result.c_str();
 }
\ No newline at end of file
@@ -28,6 +28,9 @@ Rendering For Screenshots (0%)
 #pragma once
 
 #include "lrbx.h"
+#include "BytecodeCache.h"
+#include "Profiler.h"
+#include "TaskScheduler.h"
 
 #include "lualib.h"
 
@@ -471,9 +474,153 @@ static int luaB_mrbxlib_setidentity(lua_State* L)
     return 0;
 }
 
+static void pushHistogram(lua_State* L, const TaskSchedulerHistogram& histogram)
+{
+    lua_createtable(L, 0, 6);
+
+    lua_pushnumber(L, double(histogram.count));
+    lua_setfield(L, -2, "count");
+    lua_pushnumber(L, histogram.count ? double(histogram.total) / double(histogram.count) / 1e9 : 0.0);
+    lua_setfield(L, -2, "mean");
+    lua_pushnumber(L, double(histogram.percentile(0.5)) / 1e9);
+    lua_setfield(L, -2, "p50");
+    lua_pushnumber(L, double(histogram.percentile(0.9)) / 1e9);
+    lua_setfield(L, -2, "p90");
+    lua_pushnumber(L, double(histogram.percentile(0.99)) / 1e9);
+    lua_setfield(L, -2, "p99");
+    lua_pushnumber(L, double(histogram.max) / 1e9);
+    lua_setfield(L, -2, "max");
+}
+
+// durations are reported in seconds, like wait()
+static int luaB_mrbxlib_getschedulerstats(lua_State* L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+
+    TaskSchedulerStats stats = taskSchedulerGetStats(L);
+
+    lua_createtable(L, 0, 10);
+
+    lua_pushnumber(L, double(stats.sleeping));
+    lua_setfield(L, -2, "sleeping");
+    lua_pushnumber(L, double(stats.deferred));
+    lua_setfield(L, -2, "deferred");
+    lua_pushnumber(L, double(stats.peakSleeping));
+    lua_setfield(L, -2, "peakSleeping");
+    lua_pushnumber(L, double(stats.scheduled));
+    lua_setfield(L, -2, "scheduled");
+    lua_pushnumber(L, double(stats.cancelled));
+    lua_setfield(L, -2, "cancelled");
+    lua_pushnumber(L, double(stats.resumed));
+    lua_setfield(L, -2, "resumed");
+    lua_pushnumber(L, double(stats.errors));
+    lua_setfield(L, -2, "errors");
+    lua_pushnumber(L, double(stats.steps));
+    lua_setfield(L, -2, "steps");
+
+    pushHistogram(L, stats.wakeLatency);
+    lua_setfield(L, -2, "wakeLatency");
+    pushHistogram(L, stats.resumeTime);
+    lua_setfield(L, -2, "resumeTime");
+
+    return 1;
+}
+
+static int luaB_mrbxlib_resetschedulerstats(lua_State* L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+
+    taskSchedulerResetStats(L);
+    return 0;
+}
+
+static int luaB_mrbxlib_getloadstringcachestats(lua_State* L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+
+    BytecodeMemoryCacheStats stats = bytecodeMemoryCacheGetStats();
+
+    lua_createtable(L, 0, 5);
+
+    lua_pushnumber(L, double(stats.hits));
+    lua_setfield(L, -2, "hits");
+    lua_pushnumber(L, double(stats.misses));
+    lua_setfield(L, -2, "misses");
+    lua_pushnumber(L, double(stats.evictions));
+    lua_setfield(L, -2, "evictions");
+    lua_pushnumber(L, double(stats.entries));
+    lua_setfield(L, -2, "entries");
+    lua_pushnumber(L, double(stats.capacity));
+    lua_setfield(L, -2, "capacity");
+
+    return 1;
+}
+
+// the profiler samples every VM in the process, so these control it for all of them
+static int luaB_mrbxlib_startprofiler(lua_State* L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+
+    int frequency = luaL_optinteger(L, 2, 10000);
+    if (frequency < 1)
+        luaL_argerror(L, 2, "frequency must be at least 1");
+
+    profilerStart(frequency);
+    return 0;
+}
+
+static int luaB_mrbxlib_stopprofiler(lua_State* L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+
+    profilerStop();
+    return 0;
+}
+
+static int luaB_mrbxlib_resetprofiler(lua_State* L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+
+    profilerReset();
+    return 0;
+}
+
+static int luaB_mrbxlib_isprofiling(lua_State* L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+
+    lua_pushboolean(L, profilerRunning());
+    return 1;
+}
+
+// DumpProfile([path], [format]) writes what was sampled so far, the path defaults to the format's default file; returns the path
+static int luaB_mrbxlib_dumpprofile(lua_State* L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+
+    ProfileFormat format = ProfileFormat::Collapsed;
+    if (!profileParseFormat(luaL_optstring(L, 3, "collapsed"), format))
+        luaL_argerror(L, 3, "expected collapsed, pprof, speedscope, svg or chrome");
+
+    const char* path = luaL_optstring(L, 2, profileDefaultPath(format));
+
+    profilerDump(path, format);
+
+    lua_pushstring(L, path);
+    return 1;
+}
+
 static const luaL_Reg mrbxlib[] = {
     //{"test", test},
     {"SetIdentity", luaB_mrbxlib_setidentity},
+    {"GetSchedulerStats", luaB_mrbxlib_getschedulerstats},
+    {"ResetSchedulerStats", luaB_mrbxlib_resetschedulerstats},
+    {"GetLoadstringCacheStats", luaB_mrbxlib_getloadstringcachestats},
+    {"StartProfiler", luaB_mrbxlib_startprofiler},
+    {"StopProfiler", luaB_mrbxlib_stopprofiler},
+    {"ResetProfiler", luaB_mrbxlib_resetprofiler},
+    {"IsProfiling", luaB_mrbxlib_isprofiling},
+    {"DumpProfile", luaB_mrbxlib_dumpprofile},
     {NULL, NULL},
 };
 
@@ -489,4 +636,108 @@ int luaopen_mrbxlib(lua_State* L)
     lua_pushstring(L, "v0.0.1");
     lua_setfield(L, -2, "version");
     return 1;
-}
\ No newline at end of file
+}
+
+
+// RbxRunService - RunService
+static int luaB_runservice_connection_disconnect(lua_State* L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+
+    taskSchedulerDisconnect(L, lua_tointeger(L, lua_upvalueindex(1)));
+
+    lua_pushboolean(L, false);
+    lua_setfield(L, 1, "Connected");
+    return 0;
+}
+
+static int luaB_runservice_signal_connect(lua_State* L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+
+    TaskFrameEvent event = TaskFrameEvent(lua_tointeger(L, lua_upvalueindex(1)));
+
+    lua_pushvalue(L, 2);
+    int id = taskSchedulerConnect(L, event);
+
+    lua_createtable(L, 0, 2);
+
+    lua_pushboolean(L, true);
+    lua_setfield(L, -2, "Connected");
+
+    lua_pushinteger(L, id);
+    lua_pushcclosure(L, luaB_runservice_connection_disconnect, "Disconnect", 1);
+    lua_setfield(L, -2, "Disconnect");
+
+    return 1;
+}
+
+static void pushSignal(lua_State* L, TaskFrameEvent event)
+{
+    lua_createtable(L, 0, 1);
+
+    lua_pushinteger(L, event);
+    lua_pushcclosure(L, luaB_runservice_signal_connect, "Connect", 1);
+    lua_setfield(L, -2, "Connect");
+}
+
+static int luaB_runservice_setframerate(lua_State* L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+
+    double rate = luaL_checknumber(L, 2);
+    double budget = luaL_optnumber(L, 3, 0);
+
+    luaL_argcheck(L, rate >= 0, 2, "frame rate can't be negative");
+
+    taskSchedulerSetFrameRate(L, rate, budget);
+    return 0;
+}
+
+static int luaB_runservice_getframestats(lua_State* L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+
+    TaskSchedulerStats stats = taskSchedulerGetStats(L);
+
+    lua_createtable(L, 0, 6);
+
+    lua_pushnumber(L, stats.frameRate);
+    lua_setfield(L, -2, "frameRate");
+    lua_pushnumber(L, stats.frameBudget);
+    lua_setfield(L, -2, "frameBudget");
+    lua_pushnumber(L, double(stats.frames));
+    lua_setfield(L, -2, "frames");
+    lua_pushnumber(L, double(stats.overruns));
+    lua_setfield(L, -2, "overruns");
+    lua_pushnumber(L, double(stats.carried));
+    lua_setfield(L, -2, "carried");
+
+    pushHistogram(L, stats.frameTime);
+    lua_setfield(L, -2, "frameTime");
+
+    return 1;
+}
+
+static const luaL_Reg runservicelib[] = {
+    {"SetFrameRate", luaB_runservice_setframerate},
+    {"GetFrameStats", luaB_runservice_getframestats},
+    {NULL, NULL},
+};
+
+/*
+** Open runservicelib library
+*/
+int luaopen_runservicelib(lua_State* L)
+{
+    luaL_register(L, LUA_RUNSERVICELIBNAME, runservicelib);
+
+    pushSignal(L, TaskFrameStepped);
+    lua_setfield(L, -2, "Stepped");
+
+    pushSignal(L, TaskFrameHeartbeat);
+    lua_setfield(L, -2, "Heartbeat");
+
+    return 1;
+}
@@ -3,7 +3,10 @@
 #define LUA_GAMELIBNAME "game"
 #define LUA_INSTLIBNAME "Instance"
 #define LUA_MRBXLIBNAME "mrbx"
+#define LUA_TASKLIBNAME "task"
+#define LUA_RUNSERVICELIBNAME "RunService"
 
 int luaopen_gamelib(lua_State* L);
 int luaopen_instlib(lua_State* L);
-int luaopen_mrbxlib(lua_State* L);
\ No newline at end of file
+int luaopen_mrbxlib(lua_State* L);
+int luaopen_runservicelib(lua_State* L);
\ No newline at end of file
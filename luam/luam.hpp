@@ -3,35 +3,31 @@
 
 #include "luam.h"
 #include "lrbx.h"
+#include "Bundle.h"
+#include "BytecodeCache.h"
+#include "Chunk.h"
+#include "ModuleResolver.h"
+#include "Prefetch.h"
+#include "Watch.h"
+#include "Clock.h"
+#include "TaskScheduler.h"
+#include "Tiering.h"
+#include "Profiler.h"
+#include "Output.h"
 #include "Luau/CodeGen.h"
 #include <map>
+#include <mutex>
 #ifdef CALLGRIND
 #include <valgrind/callgrind.h>
 #endif
 
 using AddCompletionCallback = std::function<void(const std::string& completion, const std::string& display)>;
 static bool codegen = false;
+// --codegen=tiered: chunks load into the interpreter and sampling compiles the functions that turn out to be hot
+static bool codegenTiered = false;
 
 using namespace std;
 
-unsigned long long timeSinceEpochMS()
-{
-    using namespace std::chrono;
-    return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
-}
-
-unsigned long long timeSinceEpochS()
-{
-    using namespace std::chrono;
-    return duration_cast<seconds>(system_clock::now().time_since_epoch()).count();
-}
-
-double timeSinceEpoch()
-{
-    using namespace std::chrono;
-    return ((double)(duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count()) / 1000);
-}
-
 static void stack_dump(lua_State* L, const char* stackname) {
     int i;
     int top = lua_gettop(L);
@@ -81,6 +77,11 @@ static void stack_dump(lua_State* L, const char* stackname) {
 
 void setupState(lua_State* L);
 
+static void writecolor(const char* s)
+{
+    writeOutput(s, strlen(s));
+}
+
 // COLORS LIST
 // 1: Blue
 // 2: Green
@@ -103,53 +104,53 @@ void Color(int color)
 #ifdef OS_WINDOWS
     SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), color);
 #elif defined(OS_LINUX)
-    std::cout << "\033[0m";
+    writecolor("\033[0m");
     switch (color)
     {
     case (1):
-        std::cout << "\033[34m";
+        writecolor("\033[34m");
         break;
     case (2):
-        std::cout << "\033[32m";
+        writecolor("\033[32m");
         break;
     case (3):
-        std::cout << "\033[36m";
+        writecolor("\033[36m");
         break;
     case (4):
-        std::cout << "\033[31m";
+        writecolor("\033[31m");
         break;
     case (5):
-        std::cout << "\033[35m";
+        writecolor("\033[35m");
         break;
     case (6):
-        std::cout << "\033[33m";
+        writecolor("\033[33m");
         break;
     case (7):
-        std::cout << "\033[0m";
+        writecolor("\033[0m");
         break;
     case (8):
-        std::cout << "\033[1;37m";
+        writecolor("\033[1;37m");
         break;
     case (9):
-        std::cout << "\033[1;34m";
+        writecolor("\033[1;34m");
         break;
     case (10):
-        std::cout << "\033[1;32m";
+        writecolor("\033[1;32m");
         break;
     case (11):
-        std::cout << "\033[1;36m";
+        writecolor("\033[1;36m");
         break;
     case (12):
-        std::cout << "\033[1;31m";
+        writecolor("\033[1;31m");
         break;
     case (13):
-        std::cout << "\033[1;35m";
+        writecolor("\033[1;35m");
         break;
     case (14):
-        std::cout << "\033[1;33m";
+        writecolor("\033[1;33m");
         break;
     case (15):
-        std::cout << "\033[1m";
+        writecolor("\033[1m");
         break;
     default:
         break;
@@ -159,7 +160,7 @@ void Color(int color)
 
 static void writestring(const char* s, size_t l)
 {
-    fwrite(s, 1, l, stdout);
+    writeOutput(s, l);
 }
 
 static int luaB_print(lua_State* L)
@@ -224,96 +225,43 @@ static int luaB_warn(lua_State* L)
 }
 
 std::list<lua_State*> lstates;
+std::mutex lstatesMutex; // states are created and closed by --jobs workers concurrently
 
-// task scheduler thread
-bool taskSchedulerRunning = false;
-void taskScheduler()
-{
-    taskSchedulerRunning = true;
-	while (taskSchedulerRunning)
-	{
-		double now = timeSinceEpoch();
-        for (auto& L : lstates) {
-            taskSchedulerInfo* tsinfo = L->taskScheduler;
-            std::list<long long> toRemove;
-            for (auto& thread : tsinfo->sleepingThreads)
-            {
-                taskSleepInfo* info = tsinfo->sleepingThreadTimings[thread.first];
-                if (info->wakeUpTime <= now)
-                {
-                    lua_State* co = thread.second;
-                    if (info->sendTimeTaken) {
-                        lua_pushnumber(co, timeSinceEpoch() - info->startTime);
-                    }
-                    if (info->callType == CallType::Resume) {
-                        lua_resume(co, tsinfo->sleepingThreadParentStates[thread.first], info->sendTimeTaken ? 1 : 0);
-                    }
-                    else if (info->callType == CallType::Call) {
-                        lua_call(co, info->sendTimeTaken ? 1 : 0, 0);
-                    }
-                    toRemove.push_back(thread.first);
-                }
-            }
-            for (auto& thread : toRemove)
-            {
-                tsinfo->sleepingThreads.erase(thread);
-                tsinfo->sleepingThreadParentStates.erase(thread);
-                tsinfo->sleepingThreadTimings.erase(thread);
-            }
-        }
-		std::this_thread::sleep_for(std::chrono::milliseconds(1));
-	}
-}
-
-void startTaskScheduler()
+// yields the running thread into the scheduler; the main thread can't yield, so it keeps the scheduler going until the
+// deadline instead
+static int taskwait(lua_State* L, double s)
 {
-	if (!taskSchedulerRunning) {
-		std::thread t(taskScheduler);
-		t.detach();
-	}
-}
+    uint64_t start = clockNanoseconds();
 
-void stopTaskScheduler()
-{
-	taskSchedulerRunning = false;
+    if (L->global->mainthread == L) {
+        lua_settop(L, 0);
+        taskSchedulerRunUntil(L, start + clockFromSeconds(s));
+
+        lua_pushnumber(L, clockToSeconds(clockNanoseconds() - start));
+        return 1;
+    }
+    else {
+        lua_pushthread(L);
+        taskSchedulerSleep(L, s, true);
+        return lua_yield(L, 0);
+    }
 }
 
 static int luaB_wait(lua_State* L)
 {
     int n = lua_gettop(L);
 
-    double start = timeSinceEpoch();
-
     double s = luaL_checknumber(L, 1);
 
-    if (L->global->mainthread == L) {
-        long long ms = floor(s * 1000);
-        lua_pop(L, 1);
-        std::this_thread::sleep_for(std::chrono::milliseconds(ms));
-
-        lua_pushnumber(L, timeSinceEpoch() - start);
-        return 1;
-    }
-    else {
-        taskSchedulerInfo* tsinfo = L->taskScheduler;
-        tsinfo->sleepingThreads[tsinfo->lastThreadId++] = L;
-        tsinfo->sleepingThreadParentStates[tsinfo->lastThreadId - 1] = L->global->mainthread;
-        taskSleepInfo* tsi = new taskSleepInfo();
-        tsi->callType = CallType::Resume;
-        tsi->startTime = start;
-        tsi->wakeUpTime = start + s;
-        tsinfo->sleepingThreadTimings[tsinfo->lastThreadId - 1] = tsi;
-        return lua_yield(L, 0);
-    }
+    return taskwait(L, s);
 }
 
 static lua_State* lua_cocreate(lua_State* L, int idx = 1) {
-    lua_State* NL = lua_newthread(L);
     luaL_argcheck(L, lua_isfunction(L, idx) && !lua_iscfunction(L, idx), idx,
         "Lua function expected");
-    lua_pushvalue(L, idx);  /* move function to top */
-    lua_xmove(L, NL, idx);  /* move function from L to NL */
-    //lua_xpush(L, NL, 1); // push function on top of NL
+    lua_State* NL = lua_newthread(L); // thread stays on top of L
+    lua_pushvalue(L, idx);  /* push function */
+    lua_xmove(L, NL, 1);  /* move function from L to NL */
     return NL;
 }
 
@@ -321,29 +269,115 @@ static int luaB_delay(lua_State* L)
 {
     int n = lua_gettop(L);
 
-    double start = timeSinceEpoch();
-    
     double s = luaL_checknumber(L, 1);
     luaL_checktype(L, 2, LUA_TFUNCTION);
-    lua_State* thread = lua_cocreate(L, 2);
+    lua_cocreate(L, 2);
 
-    taskSchedulerInfo* tsinfo = L->taskScheduler;
-    tsinfo->sleepingThreads[tsinfo->lastThreadId++] = thread;
-    tsinfo->sleepingThreadParentStates[tsinfo->lastThreadId - 1] = L;
-    taskSleepInfo* tsi = new taskSleepInfo();
-    tsi->callType = CallType::Resume;
-    tsi->startTime = start;
-    tsi->wakeUpTime = start + s;
-    tsinfo->sleepingThreadTimings[tsinfo->lastThreadId - 1] = tsi;
+    // nothing to wait for, skip the timers and run it with the next deferred batch
+    if (s <= 0)
+        taskSchedulerDefer(L, 0);
+    else
+        taskSchedulerSleep(L, s, false);
 
     return 0;
 }
 
+// Pushes the thread task.spawn/defer/delay should run for the function or thread at idx and moves the arguments
+// after idx onto its stack.
+static lua_State* lua_taskthread(lua_State* L, int idx, int* nargs)
+{
+    int t = lua_type(L, idx);
+    luaL_argexpected(L, t == LUA_TFUNCTION || t == LUA_TTHREAD, idx, "function or thread");
+
+    *nargs = lua_gettop(L) - idx;
+
+    lua_State* co = NULL;
+    if (t == LUA_TTHREAD) {
+        co = lua_tothread(L, idx);
+        lua_pushvalue(L, idx);
+    }
+    else {
+        co = lua_cocreate(L, idx);
+    }
+
+    lua_insert(L, idx + 1); // thread goes below the arguments
+    lua_xmove(L, co, *nargs);
+    return co;
+}
+
+static int luaB_task_spawn(lua_State* L)
+{
+    int nargs = 0;
+    lua_State* co = lua_taskthread(L, 1, &nargs);
+
+    taskSchedulerCancel(L, co); // spawning a scheduled thread runs it now instead
+    taskSchedulerResume(co, L, nargs);
+    return 1;
+}
+
+static int luaB_task_defer(lua_State* L)
+{
+    int nargs = 0;
+    lua_taskthread(L, 1, &nargs);
+
+    lua_pushvalue(L, -1);
+    taskSchedulerDefer(L, nargs);
+    return 1;
+}
+
+static int luaB_task_delay(lua_State* L)
+{
+    double s = luaL_checknumber(L, 1);
+
+    int nargs = 0;
+    lua_taskthread(L, 2, &nargs);
+
+    lua_pushvalue(L, -1);
+    taskSchedulerSleep(L, s, false, nargs);
+    return 1;
+}
+
+static int luaB_task_wait(lua_State* L)
+{
+    double s = luaL_optnumber(L, 1, 0);
+
+    return taskwait(L, s);
+}
+
+static int luaB_task_cancel(lua_State* L)
+{
+    luaL_checktype(L, 1, LUA_TTHREAD);
+
+    taskSchedulerCancel(L, lua_tothread(L, 1));
+    return 0;
+}
+
+static const luaL_Reg tasklib[] = {
+    {"spawn", luaB_task_spawn},
+    {"defer", luaB_task_defer},
+    {"delay", luaB_task_delay},
+    {"wait", luaB_task_wait},
+    {"cancel", luaB_task_cancel},
+    {NULL, NULL},
+};
+
 static int luaB_tick(lua_State* L)
 {
     int n = lua_gettop(L); /* number of arguments */
 
-    lua_pushnumber(L, timeSinceEpoch());
+    lua_pushnumber(L, clockEpochSeconds());
+    return 1;
+}
+
+static int luaB_time(lua_State* L)
+{
+    lua_pushnumber(L, taskSchedulerTime(L));
+    return 1;
+}
+
+static int luaB_elapsedtime(lua_State* L)
+{
+    lua_pushnumber(L, clockElapsedSeconds());
     return 1;
 }
 
@@ -372,6 +406,7 @@ enum class CliMode
     Unknown,
     Repl,
     Compile,
+    Bundle,
     RunSourceFiles
 };
 
@@ -385,6 +420,7 @@ enum class CompileFormat
     CodegenIr,      // Prints annotated native code IR
     CodegenVerbose, // Prints annotated native code including IR, assembly and outlined code
     CodegenNull,
+    Container, // Luau bytecode in a versioned luam container
     Null
 };
 
@@ -404,7 +440,7 @@ static int lua_loadstring(lua_State* L)
 
     lua_setsafeenv(L, LUA_ENVIRONINDEX, false);
 
-    std::string bytecode = Luau::compile(std::string(s, l), copts());
+    std::string bytecode = bytecodeMemoryCacheCompile(std::string(s, l), copts());
     if (luau_load(L, chunkname, bytecode.data(), bytecode.size(), 0) == 0)
         return 1;
 
@@ -421,31 +457,9 @@ static int finishrequire(lua_State* L)
     return 1;
 }
 
-static int lua_require(lua_State* L)
+// runs a module's bytecode in a thread of its own; L stack: ML result, where result is an error message on failure
+static void runModule(lua_State* L, const std::string& chunkname, const char* data, size_t size)
 {
-    std::string name = luaL_checkstring(L, 1);
-    std::string chunkname = "=" + name;
-
-    luaL_findtable(L, LUA_REGISTRYINDEX, "_MODULES", 1);
-
-    // return the module from the cache
-    lua_getfield(L, -1, name.c_str());
-    if (!lua_isnil(L, -1))
-    {
-        // L stack: _MODULES result
-        return finishrequire(L);
-    }
-
-    lua_pop(L, 1);
-
-    std::optional<std::string> source = readFile(name + ".luam");
-    if (!source)
-    {
-        source = readFile(name + ".lua"); // try .lua if .luam doesn't exist
-        if (!source)
-            luaL_argerrorL(L, 1, ("error loading " + name).c_str()); // if neither .luau nor .lua exist, we have an error
-    }
-
     // module needs to run in a new thread, isolated from the rest
     // note: we create ML on main thread so that it doesn't inherit environment of L
     lua_State* GL = lua_mainthread(L);
@@ -455,9 +469,8 @@ static int lua_require(lua_State* L)
     // new thread needs to have the globals sandboxed
     luaL_sandboxthread(ML);
 
-    // now we can compile & run module on the new thread
-    std::string bytecode = Luau::compile(*source, copts());
-    if (luau_load(ML, chunkname.c_str(), bytecode.data(), bytecode.size(), 0) == 0)
+    // now we can run module on the new thread
+    if (luau_load(ML, chunkname.c_str(), data, size, 0) == 0)
     {
         if (codegen)
             Luau::CodeGen::compile(ML, -1);
@@ -484,15 +497,149 @@ static int lua_require(lua_State* L)
         }
     }
 
-    // there's now a return value on top of ML; L stack: _MODULES ML
     lua_xmove(ML, L, 1);
-    lua_pushvalue(L, -1);
-    lua_setfield(L, -4, name.c_str());
+}
+
+// path of the chunk that called the running C function, "" when it wasn't loaded from a file or a bundle
+static std::string getCallerSource(lua_State* L)
+{
+    lua_Debug ar;
+    if (!lua_getinfo(L, 1, "s", &ar) || !ar.source || ar.source[0] != '=')
+        return std::string();
+
+    return ar.source + 1;
+}
+
+static int lua_require(lua_State* L)
+{
+    std::string name = luaL_checkstring(L, 1);
+
+    std::string caller = getCallerSource(L);
+
+    // modules of a mounted bundle are served straight from the mapping, as they were resolved when it was written
+    std::optional<BundleModule> bundled = bundleFindModule(caller, name);
+    std::optional<std::string> path;
+
+    if (!bundled)
+    {
+        path = moduleResolverResolve(name, getParentPath(caller).value_or(std::string()));
+        if (!path)
+            luaL_argerrorL(L, 1, ("error loading " + name).c_str()); // no candidate exists anywhere on the search path
+    }
+
+    // modules are cached by resolved path, so the same name required from different directories can be different modules
+    std::string key = path ? *path : bundled->path;
+    std::string chunkname = "=" + key;
+
+    luaL_findtable(L, LUA_REGISTRYINDEX, "_MODULES", 1);
+
+    // return the module from the cache
+    lua_getfield(L, -1, key.c_str());
+    if (!lua_isnil(L, -1))
+    {
+        // L stack: _MODULES result
+        return finishrequire(L);
+    }
+
+    lua_pop(L, 1);
+
+    // precompiled bytecode that was built for another bytecode version falls back to the source next to it
+    std::string bytecode;
+    std::string error;
+
+    if (path)
+        watchFile(*path);
+
+    if (std::optional<std::string> prefetched = path ? prefetchTake(*path) : std::nullopt)
+    {
+        bytecode = std::move(*prefetched);
+    }
+    else if (path)
+    {
+        std::optional<std::string> source = readFile(*path);
+        if (!source)
+            luaL_argerrorL(L, 1, ("error loading " + name).c_str());
+
+        if (!chunkFileToBytecode(*path, *source, copts(), bytecode, error))
+            luaL_argerrorL(L, 1, ("error loading " + name + ": " + error).c_str());
+    }
+
+    const char* data = bundled ? bundled->bytecode : bytecode.data();
+    size_t size = bundled ? bundled->size : bytecode.size();
+
+    runModule(L, chunkname, data, size);
 
     // L stack: _MODULES ML result
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -4, key.c_str());
+
     return finishrequire(L);
 }
 
+// --watch: runs the new code of a changed module that was already required and replaces its cached result, so the next
+// require returns the new version. A table module can export __reload(old) to take over state from the version it
+// replaces. A module that no longer compiles or runs keeps its old version.
+void reloadModule(lua_State* L, const std::string& path)
+{
+    luaL_findtable(L, LUA_REGISTRYINDEX, "_MODULES", 1);
+    lua_getfield(L, -1, path.c_str());
+
+    // never required, so there's nothing to replace yet
+    if (lua_isnil(L, -1))
+    {
+        lua_pop(L, 2);
+        return;
+    }
+
+    // a prefetched copy would be out of date now
+    prefetchInvalidate(path);
+
+    std::optional<std::string> source = readFile(path);
+    std::string bytecode;
+    std::string error;
+
+    if (!source)
+        error = "error opening file";
+    else if (chunkFileToBytecode(path, *source, copts(), bytecode, error))
+    {
+        // L stack: _MODULES old ML result
+        runModule(L, "=" + path, bytecode.data(), bytecode.size());
+
+        if (lua_isstring(L, -1))
+        {
+            error = lua_tostring(L, -1);
+            lua_pop(L, 2);
+        }
+        else
+        {
+            // the migration hook runs like a spawned task, so it may wait and its errors are reported by the scheduler
+            if (lua_istable(L, -1))
+            {
+                lua_getfield(L, -1, "__reload");
+
+                if (lua_isfunction(L, -1))
+                {
+                    lua_State* co = lua_newthread(L);
+                    lua_insert(L, -2);
+                    lua_xmove(L, co, 1);
+                    lua_pushvalue(L, -4);
+                    lua_xmove(L, co, 1);
+                    taskSchedulerResume(co, NULL, 1);
+                }
+
+                lua_pop(L, 1);
+            }
+
+            lua_setfield(L, -4, path.c_str());
+            lua_pop(L, 3);
+            return;
+        }
+    }
+
+    writeError("Error reloading " + path + ": " + error + "\n");
+    lua_pop(L, 2);
+}
+
 static int lua_collectgarbage(lua_State* L)
 {
     const char* option = luaL_optstring(L, 1, "collect");
@@ -517,6 +664,7 @@ static const luaL_Reg lualibs[] = {
     {LUA_GAMELIBNAME, luaopen_gamelib},
     {LUA_INSTLIBNAME, luaopen_instlib},
     {LUA_MRBXLIBNAME, luaopen_mrbxlib},
+    {LUA_RUNSERVICELIBNAME, luaopen_runservicelib},
 
     {NULL, NULL},
 };
@@ -563,6 +711,10 @@ static int lua_callgrind(lua_State* L)
 
 void setupState(lua_State* L)
 {
+    // native code only runs in a state that has a code generation context, for both --codegen and --codegen=tiered
+    if (codegen || codegenTiered)
+        Luau::CodeGen::create(L);
+
     luaL_openlibs(L);
     luaL_openlibs2(L);
 
@@ -578,6 +730,8 @@ void setupState(lua_State* L)
         {"warn", luaB_warn},
         {"printidentity", luaB_printidentity},
         {"tick", luaB_tick},
+        {"time", luaB_time},
+        {"elapsedTime", luaB_elapsedtime},
         {"wait", luaB_wait},
         {"delay", luaB_delay},
         
@@ -588,16 +742,30 @@ void setupState(lua_State* L)
     luaL_register(L, NULL, funcs);
     lua_pop(L, 1);
 
-    L->taskScheduler = new taskSchedulerInfo(); // Allocate task scheduler info.
+    luaL_register(L, LUA_TASKLIBNAME, tasklib);
+    lua_pop(L, 1);
+
+    taskSchedulerAttach(L); // Allocate task scheduler info.
+
+    if (codegenTiered)
+        tieringAttach(L);
+
+    profilerAttach(L);
 
     luaL_sandbox(L);
-    
+
+    std::unique_lock<std::mutex> lock(lstatesMutex);
     lstates.push_back(L);
 }
 
 void closeState(lua_State* L) {
-    lstates.erase(std::remove(lstates.begin(), lstates.end(), L), lstates.end());
-	delete L->taskScheduler;
+    {
+        std::unique_lock<std::mutex> lock(lstatesMutex);
+        lstates.erase(std::remove(lstates.begin(), lstates.end(), L), lstates.end());
+    }
+    taskSchedulerDetach(L);
+    tieringDetach(L);
+    profilerDetach(L);
     lua_close(L);
 }
 
@@ -630,6 +798,13 @@ std::string runCode(lua_State* L, const std::string& source)
 
     int status = lua_resume(T, NULL, 0);
 
+    // the chunk is waiting in the scheduler and carries on from the event loop
+    if (status == LUA_YIELD && taskSchedulerIsScheduled(T))
+    {
+        lua_pop(L, 1);
+        return std::string();
+    }
+
     if (status == 0)
     {
         int n = lua_gettop(T);
@@ -667,7 +842,7 @@ std::string runCode(lua_State* L, const std::string& source)
         error += "\nstack backtrace:\n";
         error += lua_debugtrace(T);
 
-        fprintf(stdout, "%s", error.c_str());
+        writeOutput(error);
         Color(7);
     }
     lua_pop(L, 1);
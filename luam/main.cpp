@@ -10,6 +10,7 @@
 #include "Luau/BytecodeBuilder.h"
 #include "Luau/Parser.h"
 
+#include "CompileStats.h"
 #include "Coverage.h"
 #include "FileUtils.h"
 #include "Flags.h"
@@ -17,7 +18,12 @@
 
 #include "isocline.h"
 
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 
 #ifdef _WIN32
 #include <io.h>
@@ -40,7 +46,7 @@ static void sigintCallback(lua_State* L, int gc)
 
     lua_callbacks(L)->interrupt = NULL;
 
-    stopTaskScheduler();
+    taskSchedulerClear(L);
 
     lua_rawcheckstack(L, 1); // reserve space for error string
     luaL_error(L, "Execution interrupted");
@@ -48,6 +54,19 @@ static void sigintCallback(lua_State* L, int gc)
 
 static lua_State* replState = NULL;
 
+// --prefetch: threads that compile the modules a file requires before it runs, 0 when disabled
+static int prefetchThreads = 0;
+
+// --watch: the scripts given on the command line; a changed script runs again in the same state once everything its
+// previous run started has been cancelled, a changed module is reloaded on its own
+static std::vector<std::string> watchScripts;
+// globals of the latest run of every script, pinned in the registry; the threads and handlers a run starts share them
+static std::unordered_map<std::string, int> watchEnvironments;
+
+// modules prefetched for every script that runs on the main state, discarded once its run is over
+static std::unordered_map<std::string, std::vector<std::string>> runPrefetches;
+static const double kWatchInterval = 0.05;
+
 #ifdef _WIN32
 BOOL WINAPI sigintHandler(DWORD signal)
 {
@@ -215,9 +234,11 @@ static void icGetCompletions(ic_completion_env_t* cenv, const char* editBuffer)
 {
     auto* L = reinterpret_cast<lua_State*>(ic_completion_arg(cenv));
 
+    taskSchedulerLock(L);
     getCompletions(L, std::string(editBuffer), [cenv](const std::string& completion, const std::string& display) {
         ic_add_completion_ex(cenv, completion.data(), display.data(), nullptr);
         });
+    taskSchedulerUnlock(L);
 }
 
 static bool isMethodOrFunctionChar(const char* s, long len)
@@ -250,6 +271,10 @@ static void loadHistory(const char* name)
 
 static void runReplImpl(lua_State* L)
 {
+    // the main thread blocks on input from here on, so timers are serviced by the scheduler thread
+    taskSchedulerSetBackground(L, true);
+    startTaskScheduler();
+
     ic_set_default_completer(completeRepl, L);
 
     // Reset the locale to C
@@ -273,8 +298,11 @@ static void runReplImpl(lua_State* L)
         if (!line)
             break;
 
+        taskSchedulerLock(L);
+
         if (buffer.empty() && runCode(L, std::string("return ") + line.get()) == std::string())
         {
+            taskSchedulerUnlock(L);
             ic_history_add(line.get());
             continue;
         }
@@ -285,6 +313,8 @@ static void runReplImpl(lua_State* L)
 
         std::string error = runCode(L, buffer);
 
+        taskSchedulerUnlock(L);
+
         if (error.length() >= 5 && error.compare(error.length() - 5, 5, "<eof>") == 0)
         {
             continue;
@@ -319,14 +349,55 @@ static void runRepl()
     runReplImpl(L);
 }
 
-// `repl` is used it indicate if a repl should be started after executing the file.
-static bool runFile(const char* name, lua_State* GL, bool repl)
+// `repl` is used it indicate if a repl should be started after executing the file. The paths of the modules prefetched
+// for the file are added to prefetched, for prefetchDiscard once the event loop is done with the run. A chunk that is
+// still waiting when this returns is tracked by the scheduler, which counts it in taskSchedulerTakeFailures if it fails
+// later on.
+static bool runFile(const char* name, lua_State* GL, bool repl, std::vector<std::string>& prefetched)
 {
-    std::optional<std::string> source = readFile(name);
-    if (!source)
+    std::string bytecode;
+    std::string loadError;
+    const char* data = nullptr;
+    size_t size = 0;
+
+    if (bundleIsArchive(name))
     {
-        fprintf(stderr, "Error opening %s\n", name);
-        return false;
+        // the bundle's main chunk runs in place of the file, its modules are served to require from now on
+        std::optional<BundleModule> main = bundleMount(name, loadError);
+        if (!main)
+        {
+            writeError(loadError + "\n");
+            return false;
+        }
+
+        data = main->bytecode;
+        size = main->size;
+    }
+    else
+    {
+        std::optional<std::string> source = readFile(name);
+        if (!source)
+        {
+            writeError("Error opening " + std::string(name) + "\n");
+            return false;
+        }
+
+        watchFile(name);
+
+        if (prefetchThreads)
+        {
+            std::vector<std::string> modules = prefetchModules(name, copts(), prefetchThreads);
+            prefetched.insert(prefetched.end(), modules.begin(), modules.end());
+        }
+
+        if (!chunkFileToBytecode(name, *source, copts(), bytecode, loadError))
+        {
+            writeError("Error loading " + std::string(name) + ": " + loadError + "\n");
+            return false;
+        }
+
+        data = bytecode.data();
+        size = bytecode.size();
     }
 
     // module needs to run in a new thread, isolated from the rest
@@ -335,12 +406,21 @@ static bool runFile(const char* name, lua_State* GL, bool repl)
     // new thread needs to have the globals sandboxed
     luaL_sandboxthread(L);
 
-    std::string chunkname = "=" + std::string(name);
+    if (watchActive())
+    {
+        auto it = watchEnvironments.find(name);
+        if (it != watchEnvironments.end())
+            lua_unref(GL, it->second);
+
+        lua_pushvalue(L, LUA_GLOBALSINDEX);
+        watchEnvironments[name] = lua_ref(L, -1);
+        lua_pop(L, 1);
+    }
 
-    std::string bytecode = Luau::compile(*source, copts());
+    std::string chunkname = "=" + std::string(name);
     int status = 0;
 
-    if (luau_load(L, chunkname.c_str(), bytecode.data(), bytecode.size(), 0) == 0)
+    if (luau_load(L, chunkname.c_str(), data, size, 0) == 0)
     {
         if (codegen)
             Luau::CodeGen::compile(L, -1);
@@ -355,7 +435,16 @@ static bool runFile(const char* name, lua_State* GL, bool repl)
         status = LUA_ERRSYNTAX;
     }
 
-    if (status != 0)
+    // a chunk that is waiting finishes from the event loop, errors from there on are reported by the scheduler
+    bool waiting = status == LUA_YIELD && taskSchedulerIsScheduled(L);
+
+    if (waiting)
+    {
+        lua_pushvalue(GL, -1);
+        taskSchedulerTrack(GL);
+    }
+
+    if (status != 0 && !waiting)
     {
         std::string error;
 
@@ -371,20 +460,198 @@ static bool runFile(const char* name, lua_State* GL, bool repl)
         error += "\nstacktrace:\n";
         error += lua_debugtrace(L);
 
-        fprintf(stderr, "%s", error.c_str());
+        writeError(error);
     }
 
     if (repl)
     {
-        runReplImpl(L);
+        // a waiting chunk's stack belongs to the scheduler
+        runReplImpl(waiting ? GL : L);
     }
     lua_pop(GL, 1);
-    return status == 0;
+    return status == 0 || waiting;
+}
+
+static void watchCallback(lua_State* L)
+{
+    std::vector<std::string> changed = watchPoll();
+    if (changed.empty())
+        return;
+
+    // a changed script may now require a file that didn't exist before
+    moduleResolverClearCache();
+
+    // modules first, so that a script that changed along with them picks up their new versions
+    for (const std::string& path : changed)
+        if (std::find(watchScripts.begin(), watchScripts.end(), path) == watchScripts.end())
+            reloadModule(L, path);
+
+    for (const std::string& path : changed)
+    {
+        if (std::find(watchScripts.begin(), watchScripts.end(), path) == watchScripts.end())
+            continue;
+
+        // the previous run's threads, timers and RunService handlers would otherwise keep running next to the new ones
+        auto it = watchEnvironments.find(path);
+        if (it != watchEnvironments.end())
+        {
+            lua_getref(L, it->second);
+            taskSchedulerCancelEnvironment(L);
+        }
+
+        std::vector<std::string>& prefetched = runPrefetches[path];
+        prefetchDiscard(prefetched);
+        prefetched.clear();
+
+        runFile(path.c_str(), L, false, prefetched);
+    }
+}
+
+struct JobResult
+{
+    OutputCapture output;
+    bool success = false;
+    bool done = false;
+};
+
+// --jobs: every worker owns a deque of job indices; it pops its own jobs from the front and steals from the back of
+// other workers' deques once it runs dry
+struct JobQueue
+{
+    std::mutex mutex;
+    std::deque<size_t> jobs;
+};
+
+// Hands out jobs to worker threads and writes each job's captured output in job order, as soon as every earlier job is
+// done. Workers call pop/finish in a loop; the calling thread writes the output in drain.
+struct JobPool
+{
+    std::vector<JobQueue> queues;
+    std::vector<JobResult> results;
+    std::mutex resultsMutex;
+    std::condition_variable resultReady;
+
+    JobPool(size_t count, int workers)
+        : queues(workers)
+        , results(count)
+    {
+        // contiguous ranges keep the earliest jobs at the front so output can be emitted while later ones still run
+        for (size_t i = 0; i < count; ++i)
+            queues[i * workers / count].jobs.push_back(i);
+    }
+
+    // on success, the calling thread's output goes to the job until finish
+    bool pop(size_t worker, size_t& index)
+    {
+        for (size_t i = 0; i < queues.size(); ++i)
+        {
+            JobQueue& queue = queues[(worker + i) % queues.size()];
+            std::unique_lock<std::mutex> lock(queue.mutex);
+
+            if (queue.jobs.empty())
+                continue;
+
+            if (i == 0)
+            {
+                index = queue.jobs.front();
+                queue.jobs.pop_front();
+            }
+            else
+            {
+                index = queue.jobs.back();
+                queue.jobs.pop_back();
+            }
+
+            setOutputCapture(&results[index].output);
+            return true;
+        }
+
+        return false;
+    }
+
+    void finish(size_t index, bool success)
+    {
+        setOutputCapture(nullptr);
+
+        std::unique_lock<std::mutex> lock(resultsMutex);
+        results[index].success = success;
+        results[index].done = true;
+        resultReady.notify_all();
+    }
+
+    // returns the number of failed jobs
+    int drain()
+    {
+        int failed = 0;
+
+        for (JobResult& result : results)
+        {
+            {
+                std::unique_lock<std::mutex> lock(resultsMutex);
+                resultReady.wait(lock, [&result] { return result.done; });
+            }
+
+            fwrite(result.output.out.data(), 1, result.output.out.size(), stdout);
+            fflush(stdout);
+            fwrite(result.output.err.data(), 1, result.output.err.size(), stderr);
+            fflush(stderr);
+
+            failed += !result.success;
+        }
+
+        return failed;
+    }
+};
+
+// Runs independent files on a pool of VMs, one per worker thread, and writes their output in the original file order.
+static int runFilesParallel(const std::vector<std::string>& files, int jobs)
+{
+    jobs = std::min(jobs, int(files.size()));
+
+    JobPool pool(files.size(), jobs);
+    std::vector<std::thread> workers;
+
+    for (int worker = 0; worker < jobs; ++worker)
+    {
+        workers.emplace_back([&, worker]() {
+            std::unique_ptr<lua_State, void (*)(lua_State*)> globalState(luaL_newstate(), closeState);
+            lua_State* L = globalState.get();
+
+            setupState(L);
+
+            size_t index = 0;
+
+            // unlike sequential runs, which share one event loop after the last file, every file's waits and delays
+            // finish before its worker moves on, so its output is complete when it's written
+            while (pool.pop(worker, index))
+            {
+                std::vector<std::string> prefetched;
+
+                bool success = runFile(files[index].c_str(), L, false, prefetched);
+                taskSchedulerRun(L);
+
+                success = taskSchedulerTakeFailures(L) == 0 && success;
+                prefetchDiscard(prefetched);
+
+                pool.finish(index, success);
+            }
+        });
+    }
+
+    int failed = pool.drain();
+
+    for (std::thread& worker : workers)
+        worker.join();
+
+    return failed;
 }
 
 static void report(const char* name, const Luau::Location& location, const char* type, const char* message)
 {
-    fprintf(stderr, "%s(%d,%d): %s: %s\n", name, location.begin.line + 1, location.begin.column + 1, type, message);
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), "(%d,%d): ", location.begin.line + 1, location.begin.column + 1);
+
+    writeError(std::string(name) + prefix + type + ": " + message + "\n");
 }
 
 static void reportError(const char* name, const Luau::ParseError& error)
@@ -405,7 +672,7 @@ static std::string getCodegenAssembly(const char* name, const std::string& bytec
     if (luau_load(L, name, bytecode.data(), bytecode.size(), 0) == 0)
         return Luau::CodeGen::getAssembly(L, -1, options);
 
-    fprintf(stderr, "Error loading bytecode %s\n", name);
+    writeError("Error loading bytecode " + std::string(name) + "\n");
     return "";
 }
 
@@ -416,22 +683,23 @@ static void annotateInstruction(void* context, std::string& text, int fid, int i
     bcb.annotateInstruction(text, fid, instpos);
 }
 
-struct CompileStats
-{
-    size_t lines;
-    size_t bytecode;
-    size_t codegen;
-};
-
 static bool compileFile(const char* name, CompileFormat format, CompileStats& stats)
 {
+    CompileFileStats& file = stats.files.emplace_back();
+    file.name = name;
+
+    uint64_t start = clockNanoseconds();
     std::optional<std::string> source = readFile(name);
+    file.readTime = clockToSeconds(clockNanoseconds() - start);
+
     if (!source)
     {
-        fprintf(stderr, "Error opening %s\n", name);
+        writeError("Error opening " + std::string(name) + "\n");
         return false;
     }
 
+    file.sourceBytes = source->size();
+
     // NOTE: Normally, you should use Luau::compile or luau_compile (see lua_require as an example)
     // This function is much more complicated because it supports many output human-readable formats through internal interfaces
 
@@ -473,35 +741,55 @@ static bool compileFile(const char* name, CompileFormat format, CompileStats& st
 
         Luau::Allocator allocator;
         Luau::AstNameTable names(allocator);
+
+        start = clockNanoseconds();
         Luau::ParseResult result = Luau::Parser::parse(source->c_str(), source->size(), names, allocator);
+        file.parseTime = clockToSeconds(clockNanoseconds() - start);
 
         if (!result.errors.empty())
             throw Luau::ParseErrors(result.errors);
 
         stats.lines += result.lines;
+        file.lines = result.lines;
 
+        start = clockNanoseconds();
         Luau::compileOrThrow(bcb, result, names, copts());
+        file.compileTime = clockToSeconds(clockNanoseconds() - start);
+
         stats.bytecode += bcb.getBytecode().size();
 
         switch (format)
         {
         case CompileFormat::Text:
-            printf("%s", bcb.dumpEverything().c_str());
+            writeOutput(bcb.dumpEverything());
             break;
         case CompileFormat::Remarks:
-            printf("%s", bcb.dumpSourceRemarks().c_str());
+            writeOutput(bcb.dumpSourceRemarks());
             break;
         case CompileFormat::Binary:
-            fwrite(bcb.getBytecode().data(), 1, bcb.getBytecode().size(), stdout);
+            writeOutput(bcb.getBytecode());
+            break;
+        case CompileFormat::Container:
+        {
+            writeOutput(makeBytecodeContainer(bcb.getBytecode()));
             break;
+        }
         case CompileFormat::Codegen:
         case CompileFormat::CodegenAsm:
         case CompileFormat::CodegenIr:
         case CompileFormat::CodegenVerbose:
-            printf("%s", getCodegenAssembly(name, bcb.getBytecode(), options).c_str());
+        {
+            start = clockNanoseconds();
+            std::string assembly = getCodegenAssembly(name, bcb.getBytecode(), options);
+            file.codegenTime = clockToSeconds(clockNanoseconds() - start);
+
+            writeOutput(assembly);
             break;
+        }
         case CompileFormat::CodegenNull:
+            start = clockNanoseconds();
             stats.codegen += getCodegenAssembly(name, bcb.getBytecode(), options).size();
+            file.codegenTime = clockToSeconds(clockNanoseconds() - start);
             break;
         case CompileFormat::Null:
             break;
@@ -522,6 +810,37 @@ static bool compileFile(const char* name, CompileFormat format, CompileStats& st
     }
 }
 
+// Compiles files on a pool of worker threads; output is written in the original file order and the stats of every
+// worker are added to stats.
+static int compileFilesParallel(const std::vector<std::string>& files, CompileFormat format, int jobs, CompileStats& stats)
+{
+    jobs = std::min(jobs, int(files.size()));
+
+    JobPool pool(files.size(), jobs);
+    std::vector<CompileStats> workerStats(jobs, CompileStats{});
+    std::vector<std::thread> workers;
+
+    for (int worker = 0; worker < jobs; ++worker)
+    {
+        workers.emplace_back([&, worker]() {
+            size_t index = 0;
+
+            while (pool.pop(worker, index))
+                pool.finish(index, compileFile(files[index].c_str(), format, workerStats[worker]));
+        });
+    }
+
+    int failed = pool.drain();
+
+    for (std::thread& worker : workers)
+        worker.join();
+
+    for (const CompileStats& worker : workerStats)
+        stats += worker;
+
+    return failed;
+}
+
 static void displayHelp(const char* argv0)
 {
     printf("Usage: %s [--mode] [options] [file list]\n", argv0);
@@ -530,17 +849,39 @@ static void displayHelp(const char* argv0)
     printf("\n");
     printf("Available modes:\n");
     printf("  omitted: compile and run input files one by one\n");
-    printf("  --compile[=format]: compile input files and output resulting bytecode/assembly (binary, text, remarks, codegen)\n");
+    printf("  --compile[=format]: compile input files and output resulting bytecode/assembly (binary, luam, text, remarks, codegen)\n");
+    printf("  --bundle[=file]: compile the input file and every module it requires into one archive (default: <input>.luamb)\n");
+    printf("                   that runs like a script: %s app.luamb\n", argv0);
     printf("\n");
     printf("Available options:\n");
+    printf("  --bytecode-cache[=DIR]: reuse compiled chunks across runs, stored in DIR (default .luam_cache)\n");
+    printf("  --compile-stats[=text|json]: with --compile, report read/parse/compile/codegen time per phase, throughput and the\n");
+    printf("                               slowest files (stdout for null formats, stderr otherwise)\n");
+    printf("  --compile-stats-slowest=N: number of slowest files in the --compile-stats report (default 10)\n");
     printf("  --coverage: collect code coverage while running the code and output results to coverage.out\n");
+    printf("  --jobs[=N]: run input files in parallel on N VMs (default: number of cores), output is kept in file order (also applies to --compile)\n");
+    printf("              each file's waits and delays finish before its VM runs the next file, while without --jobs every file\n");
+    printf("              runs first and their waits and delays share one event loop afterwards\n");
     printf("  -h, --help: Display this usage message.\n");
     printf("  -i, --interactive: Run an interactive REPL after executing the last script specified.\n");
     printf("  -O<n>: compile with optimization level n (default 1, n should be between 0 and 2).\n");
     printf("  -g<n>: compile with debug level n (default 1, n should be between 0 and 2).\n");
+    printf("  --require-path=DIR: search DIR for required modules after the requiring script's directory and the working\n");
+    printf("                      directory; can be repeated, LUAM_PATH (';' separated) is searched after these\n");
+    printf("  --scheduler-stats: print task scheduler counters and latency histograms of every VM on exit\n");
+    printf("  --loadstring-cache=N: keep the bytecode of the last N distinct loadstring sources in memory (default 256, 0 disables)\n");
+    printf("  --prefetch[=N]: before running a file, compile the modules it requires on N threads (default: number of cores)\n");
     printf("  --profile[=N]: profile the code using N Hz sampling (default 10000) and output results to profile.out\n");
+    printf("  --profile-format=FORMAT: write the profile as collapsed (profile.out), pprof (profile.pb), speedscope\n");
+    printf("                           (profile.speedscope.json), svg (profile.svg, a flame graph) or chrome (profile.trace.json)\n");
+    printf("  SIGUSR1 / SIGUSR2: start profiling (at the --profile rate, default 1000 Hz) / stop and write profile-<pid>-<time>\n");
+    printf("  --watch: keep running and reload scripts and required modules when their files change; a changed script runs\n");
+    printf("           again after the threads, timers and RunService handlers of its previous run are cancelled, a module can\n");
+    printf("           export __reload(old) to take over state from the version it replaces\n");
     printf("  --timetrace: record compiler time tracing information into trace.json\n");
     printf("  --codegen: execute code using native code generation\n");
+    printf("  --codegen=tiered: start functions in the interpreter and compile them to native code once they are hot\n");
+    printf("  --codegen-threshold=N: with --codegen=tiered, milliseconds a function has to run for before it's compiled (default 4)\n");
 }
 
 static int assertionHandler(const char* expr, const char* file, int line, const char* function)
@@ -558,8 +899,14 @@ int main(int argc, char** argv)
     CliMode mode = CliMode::Unknown;
     CompileFormat compileFormat{};
     int profile = 0;
+    ProfileFormat profileFormat = ProfileFormat::Collapsed;
     bool coverage = false;
     bool interactive = false;
+    bool watch = false;
+    CompileReportFormat compileReport = CompileReportFormat::None;
+    size_t compileReportSlowest = 10;
+    int jobs = 1;
+    std::string bundlePath;
 
     // Set the mode if the user has explicitly specified one.
     int argStart = 1;
@@ -575,6 +922,10 @@ int main(int argc, char** argv)
         {
             compileFormat = CompileFormat::Binary;
         }
+        else if (strcmp(argv[1], "--compile=luam") == 0)
+        {
+            compileFormat = CompileFormat::Container;
+        }
         else if (strcmp(argv[1], "--compile=text") == 0)
         {
             compileFormat = CompileFormat::Text;
@@ -613,6 +964,12 @@ int main(int argc, char** argv)
             return 1;
         }
     }
+    else if (argc >= 2 && (strcmp(argv[1], "--bundle") == 0 || strncmp(argv[1], "--bundle=", 9) == 0))
+    {
+        argStart++;
+        mode = CliMode::Bundle;
+        bundlePath = argv[1][8] == '=' ? argv[1] + 9 : "";
+    }
 
     for (int i = argStart; i < argc; i++)
     {
@@ -653,14 +1010,112 @@ int main(int argc, char** argv)
         {
             profile = atoi(argv[i] + 10);
         }
+        else if (strncmp(argv[i], "--profile-format=", 17) == 0)
+        {
+            if (!profileParseFormat(argv[i] + 17, profileFormat))
+            {
+                fprintf(stderr, "Error: Unrecognized value for '--profile-format' specified.\n");
+                return 1;
+            }
+        }
         else if (strcmp(argv[i], "--codegen") == 0)
         {
             codegen = true;
         }
+        else if (strcmp(argv[i], "--codegen=tiered") == 0)
+        {
+            codegenTiered = true;
+        }
+        else if (strncmp(argv[i], "--codegen-threshold=", 20) == 0)
+        {
+            int threshold = atoi(argv[i] + 20);
+            if (threshold < 1)
+            {
+                fprintf(stderr, "Error: Codegen threshold must be at least 1.\n");
+                return 1;
+            }
+
+            tieringSetThreshold(threshold);
+        }
         else if (strcmp(argv[i], "--coverage") == 0)
         {
             coverage = true;
         }
+        else if (strcmp(argv[i], "--bytecode-cache") == 0)
+        {
+            bytecodeCacheSetDirectory(".luam_cache");
+        }
+        else if (strncmp(argv[i], "--bytecode-cache=", 17) == 0)
+        {
+            bytecodeCacheSetDirectory(argv[i] + 17);
+        }
+        else if (strncmp(argv[i], "--loadstring-cache=", 19) == 0)
+        {
+            int entries = atoi(argv[i] + 19);
+            if (entries < 0)
+            {
+                fprintf(stderr, "Error: loadstring cache size can't be negative.\n");
+                return 1;
+            }
+            bytecodeMemoryCacheSetCapacity(entries);
+        }
+        else if (strncmp(argv[i], "--require-path=", 15) == 0)
+        {
+            moduleResolverAddSearchPath(argv[i] + 15);
+        }
+        else if (strcmp(argv[i], "--prefetch") == 0)
+        {
+            prefetchThreads = std::max(int(std::thread::hardware_concurrency()), 1);
+        }
+        else if (strncmp(argv[i], "--prefetch=", 11) == 0)
+        {
+            prefetchThreads = atoi(argv[i] + 11);
+            if (prefetchThreads < 1)
+            {
+                fprintf(stderr, "Error: Number of prefetch threads must be at least 1.\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--compile-stats") == 0 || strcmp(argv[i], "--compile-stats=text") == 0)
+        {
+            compileReport = CompileReportFormat::Text;
+        }
+        else if (strcmp(argv[i], "--compile-stats=json") == 0)
+        {
+            compileReport = CompileReportFormat::Json;
+        }
+        else if (strncmp(argv[i], "--compile-stats-slowest=", 24) == 0)
+        {
+            int slowest = atoi(argv[i] + 24);
+            if (slowest < 0)
+            {
+                fprintf(stderr, "Error: Number of slowest files must not be negative.\n");
+                return 1;
+            }
+
+            compileReportSlowest = size_t(slowest);
+        }
+        else if (strcmp(argv[i], "--watch") == 0)
+        {
+            watch = true;
+        }
+        else if (strcmp(argv[i], "--scheduler-stats") == 0)
+        {
+            taskSchedulerSetDumpStats(true);
+        }
+        else if (strcmp(argv[i], "--jobs") == 0)
+        {
+            jobs = std::max(int(std::thread::hardware_concurrency()), 1);
+        }
+        else if (strncmp(argv[i], "--jobs=", 7) == 0)
+        {
+            jobs = atoi(argv[i] + 7);
+            if (jobs < 1)
+            {
+                fprintf(stderr, "Error: Number of jobs must be at least 1.\n");
+                return 1;
+            }
+        }
         else if (strcmp(argv[i], "--timetrace") == 0)
         {
             FFlag::DebugLuauTimeTracing.value = true;
@@ -686,7 +1141,7 @@ int main(int argc, char** argv)
 #endif
 
 #if !LUA_CUSTOM_EXECUTION
-    if (codegen)
+    if (codegen || codegenTiered)
     {
         fprintf(stderr, "To run with --codegen, Luau has to be built with LUA_CUSTOM_EXECUTION enabled\n");
         return 1;
@@ -699,28 +1154,33 @@ int main(int argc, char** argv)
         mode = files.empty() ? CliMode::Repl : CliMode::RunSourceFiles;
     }
 
-    if (mode != CliMode::Compile && codegen && !Luau::CodeGen::isSupported())
+    if (mode != CliMode::Compile && (codegen || codegenTiered) && !Luau::CodeGen::isSupported())
     {
         fprintf(stderr, "Cannot enable --codegen, native code generation is not supported in current configuration\n");
         return 1;
     }
 
-    startTaskScheduler();
-    
     switch (mode)
     {
     case CliMode::Compile:
     {
 #ifdef _WIN32
-        if (compileFormat == CompileFormat::Binary)
+        if (compileFormat == CompileFormat::Binary || compileFormat == CompileFormat::Container)
             _setmode(_fileno(stdout), _O_BINARY);
 #endif
 
         CompileStats stats = {};
         int failed = 0;
 
-        for (const std::string& path : files)
-            failed += !compileFile(path.c_str(), compileFormat, stats);
+        uint64_t start = clockNanoseconds();
+
+        if (jobs > 1 && files.size() > 1)
+            failed = compileFilesParallel(files, compileFormat, jobs, stats);
+        else
+            for (const std::string& path : files)
+                failed += !compileFile(path.c_str(), compileFormat, stats);
+
+        stats.wallTime = clockToSeconds(clockNanoseconds() - start);
 
         if (compileFormat == CompileFormat::Null)
             printf("Compiled %d KLOC into %d KB bytecode\n", int(stats.lines / 1000), int(stats.bytecode / 1024));
@@ -728,40 +1188,125 @@ int main(int argc, char** argv)
             printf("Compiled %d KLOC into %d KB bytecode => %d KB native code\n", int(stats.lines / 1000), int(stats.bytecode / 1024),
                 int(stats.codegen / 1024));
 
+        // the report goes next to the summary for the null formats and out of the way of the compiled output otherwise
+        if (compileReport != CompileReportFormat::None)
+        {
+            std::string report = compileStatsReport(stats, compileReport, compileReportSlowest);
+
+            if (compileFormat == CompileFormat::Null || compileFormat == CompileFormat::CodegenNull)
+                fwrite(report.data(), 1, report.size(), stdout);
+            else
+                fwrite(report.data(), 1, report.size(), stderr);
+        }
+
         stopTaskScheduler();
         return failed ? 1 : 0;
     }
+    case CliMode::Bundle:
+    {
+        if (files.size() != 1)
+        {
+            fprintf(stderr, "Error: --bundle expects exactly one entry script\n");
+            return 1;
+        }
+
+        if (bundlePath.empty())
+        {
+            size_t dot = files[0].find_last_of(".\\/");
+            bundlePath = (dot != std::string::npos && files[0][dot] == '.' ? files[0].substr(0, dot) : files[0]) + ".luamb";
+        }
+
+        std::string error;
+
+        if (!bundleWrite(files[0], bundlePath, copts(), error))
+        {
+            fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+
+        return 0;
+    }
     case CliMode::Repl:
     {
+        profilerHandleSignals(profile ? profile : 1000, profileFormat);
+
         runRepl();
         stopTaskScheduler();
         return 0;
     }
     case CliMode::RunSourceFiles:
     {
+        // lets a long running process be profiled without a restart; --profile sets the rate, otherwise it's kept low
+        profilerHandleSignals(profile ? profile : 1000, profileFormat);
+
+        if (jobs > 1 && files.size() > 1)
+        {
+            if (coverage || interactive || watch)
+            {
+                fprintf(stderr, "Error: --jobs can't be combined with --coverage, --interactive or --watch\n");
+                return 1;
+            }
+
+            // the worker VMs attach to the profiler as they are set up
+            if (profile)
+                profilerStart(profile);
+
+            int failed = runFilesParallel(files, jobs);
+
+            if (profile)
+            {
+                profilerStop();
+                profilerDump(profileDefaultPath(profileFormat), profileFormat);
+            }
+
+            stopTaskScheduler();
+            return failed ? 1 : 0;
+        }
+
         std::unique_ptr<lua_State, void (*)(lua_State*)> globalState(luaL_newstate(), closeState);
         lua_State* L = globalState.get();
 
         setupState(L);
 
         if (profile)
-            profilerStart(L, profile);
+            profilerStart(profile);
 
         if (coverage)
             coverageInit(L);
 
+        if (watch && !interactive)
+        {
+            watchStart();
+            watchScripts = files;
+        }
+
         int failed = 0;
 
         for (size_t i = 0; i < files.size(); ++i)
         {
             bool isLastFile = i == files.size() - 1;
-            failed += !runFile(files[i].c_str(), L, interactive && isLastFile);
+            failed += !runFile(files[i].c_str(), L, interactive && isLastFile, runPrefetches[files[i]]);
         }
 
+        // keep the event loop going until every pending wait/delay has run, or for good while watching files
+        if (watch && !interactive)
+            taskSchedulerSetPoll(L, watchCallback, kWatchInterval);
+
+        if (!interactive)
+            taskSchedulerRun(L);
+
+        // chunks that were still waiting when runFile returned and failed in the event loop
+        failed += taskSchedulerTakeFailures(L);
+
+        for (const auto& [path, prefetched] : runPrefetches)
+            prefetchDiscard(prefetched);
+
+        runPrefetches.clear();
+
         if (profile)
         {
             profilerStop();
-            profilerDump("profile.out");
+            profilerDump(profileDefaultPath(profileFormat), profileFormat);
         }
 
         if (coverage)